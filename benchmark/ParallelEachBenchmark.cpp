@@ -0,0 +1,94 @@
+#include "../src/ECS/ECS.h"
+#include "../src/ThreadPool/ThreadPool.h"
+#include "../src/Components/TransformComponent.h"
+#include "../src/Components/RigidBodyComponent.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// PARALLEL EACH BENCHMARK
+////////////////////////////////////////////////////////////////////////////////////////
+// Moves 1k to 1M entities through the transform/rigid body group, on the calling thread
+// (each) and split over the thread pool (ParallelEach), and prints the median time of
+// both. From the fixed cost of splitting the work and the cost of one entity, it
+// estimates the entity count from which ParallelEach pays off with 2, 4 and 8 cores,
+// which is what PARALLEL_EACH_MIN_ENTITIES should be close to.
+// Built with -DECS_PARALLEL_EACH_MIN_ENTITIES=0, so ParallelEach always splits the work.
+// On a single core the workers never run next to the calling thread, so the measured cost
+// of splitting leaves out waking a worker up, and the estimates are a lower bound.
+////////////////////////////////////////////////////////////////////////////////////////
+
+const int ENTITY_COUNTS[] = {1000, 2000, 4096, 10000, 100000, 1000000};
+// Every measurement moves about this many entities in total, so the small counts get enough runs
+const int NUM_ENTITY_UPDATES = 20000000;
+const int MIN_RUNS = 21;
+
+template <typename TFunc>
+double MedianMicroseconds(int numRuns, TFunc func)
+{
+    // Warm the caches and wake the workers up first
+    for (int run = 0; run < numRuns / 10; run++)
+    {
+        func();
+    }
+    std::vector<double> times;
+    for (int run = 0; run < numRuns; run++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main()
+{
+    static_assert(PARALLEL_EACH_MIN_ENTITIES == 0, "Build the benchmark with -DECS_PARALLEL_EACH_MIN_ENTITIES=0");
+    auto threadPool = std::make_unique<ThreadPool>();
+    const double deltaTime = 1.0 / 60.0;
+    auto move = [deltaTime](TransformComponent &transform, const RigidBodyComponent &rigidBody)
+    {
+        transform.position.x += rigidBody.velocity.x * deltaTime;
+        transform.position.y += rigidBody.velocity.y * deltaTime;
+    };
+
+    std::printf("%d cores, %d workers, chunks of %d entities\n", std::thread::hardware_concurrency(), threadPool->GetNumThreads(), PARALLEL_EACH_CHUNK_SIZE);
+    std::printf("%10s %14s %14s %10s\n", "entities", "each (us)", "parallel (us)", "speedup");
+    double splitOverhead = -1.0;
+    double nanosecondsPerEntity = 0.0;
+    for (const int numEntities : ENTITY_COUNTS)
+    {
+        Registry registry;
+        registry.CreateEntities(numEntities, TransformComponent(glm::vec2(0.0, 0.0)), RigidBodyComponent(glm::vec2(10.0, 5.0)));
+        registry.Update();
+        auto &group = registry.GetGroup<TransformComponent, RigidBodyComponent>();
+
+        const int numRuns = std::max(MIN_RUNS, NUM_ENTITY_UPDATES / numEntities);
+        const double serialTime = MedianMicroseconds(numRuns, [&]()
+                                                     { group.each(move); });
+        const double parallelTime = MedianMicroseconds(numRuns, [&]()
+                                                       { group.ParallelEach(threadPool, move); });
+        std::printf("%10d %14.1f %14.1f %9.2fx\n", numEntities, serialTime, parallelTime, serialTime / parallelTime);
+
+        // The first count split in several chunks only has a couple of them, so its extra time
+        // is the cost of splitting the work (a single chunk runs on the calling thread)
+        if (splitOverhead < 0.0 && numEntities > PARALLEL_EACH_CHUNK_SIZE)
+        {
+            splitOverhead = std::max(0.0, parallelTime - serialTime);
+        }
+        nanosecondsPerEntity = serialTime * 1000.0 / numEntities;
+    }
+
+    // With P cores the split saves (1 - 1/P) of the serial time, it pays off once that exceeds the overhead
+    std::printf("Splitting costs %.1f us, moving one entity %.2f ns, ParallelEach pays off from about:\n", splitOverhead, nanosecondsPerEntity);
+    for (const int numCores : {2, 4, 8})
+    {
+        const double breakEven = splitOverhead * 1000.0 / (nanosecondsPerEntity * (1.0 - 1.0 / numCores));
+        std::printf("  %d cores: %.0f entities\n", numCores, breakEven);
+    }
+    return 0;
+}
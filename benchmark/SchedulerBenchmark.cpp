@@ -0,0 +1,96 @@
+#include "../src/ECS/ECS.h"
+#include "../src/ThreadPool/ThreadPool.h"
+#include "../src/Components/TransformComponent.h"
+#include "../src/Components/RigidBodyComponent.h"
+#include "../src/Components/HealthComponent.h"
+#include "../src/Systems/MovementSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// SCHEDULER BENCHMARK
+////////////////////////////////////////////////////////////////////////////////////////
+// Runs the scheduled systems over a large world with 1, 2, 4 and one worker per core,
+// and prints the median frame time of each run. MovementSystem and the regeneration
+// system touch different components, so they also run at the same time.
+////////////////////////////////////////////////////////////////////////////////////////
+
+const int NUM_ENTITIES = 1000000;
+const int NUM_WARMUP_FRAMES = 10;
+const int NUM_FRAMES = 100;
+
+// Some arithmetic per entity, so the frame isn't only bound by memory bandwidth
+class RegenerationSystem : public System
+{
+public:
+    RegenerationSystem()
+    {
+        RequireComponent<Writes<HealthComponent>>();
+    }
+
+    void Update(std::unique_ptr<Registry> &registry, std::unique_ptr<ThreadPool> &threadPool)
+    {
+        registry->View<HealthComponent>().ParallelEach(threadPool, [](Entity, auto &health)
+                                                       {
+            int healthPercentage = health.healthPercentage;
+            for (int i = 0; i < 16; i++)
+            {
+                healthPercentage = (healthPercentage * 7 + 3) % 101;
+            }
+            health.healthPercentage = healthPercentage; });
+    }
+};
+
+// Returns the median frame time in milliseconds
+double RunFrames(int numWorkers)
+{
+    auto threadPool = std::make_unique<ThreadPool>(numWorkers);
+    auto registry = std::make_unique<Registry>();
+    registry->AddSystem<MovementSystem>();
+    registry->AddSystem<RegenerationSystem>();
+    registry->CreateEntities(NUM_ENTITIES, TransformComponent(glm::vec2(0.0, 0.0)), RigidBodyComponent(glm::vec2(10.0, 5.0)), HealthComponent(100));
+    registry->Update();
+
+    const double deltaTime = 1.0 / 60.0;
+    registry->ScheduleSystem<MovementSystem>([&](MovementSystem &system)
+                                             { system.Update(registry, threadPool, deltaTime); });
+    registry->ScheduleSystem<RegenerationSystem>([&](RegenerationSystem &system)
+                                                 { system.Update(registry, threadPool); });
+
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < NUM_WARMUP_FRAMES + NUM_FRAMES; frame++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        registry->RunScheduledSystems(threadPool);
+        registry->Update();
+        const auto end = std::chrono::steady_clock::now();
+        if (frame >= NUM_WARMUP_FRAMES)
+        {
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    return frameTimes[frameTimes.size() / 2];
+}
+
+int main()
+{
+    std::vector<int> workerCounts = {1, 2, 4, static_cast<int>(std::thread::hardware_concurrency())};
+    std::sort(workerCounts.begin(), workerCounts.end());
+    workerCounts.erase(std::unique(workerCounts.begin(), workerCounts.end()), workerCounts.end());
+
+    std::vector<double> medianFrameTimes;
+    for (int numWorkers : workerCounts)
+    {
+        medianFrameTimes.push_back(RunFrames(numWorkers));
+    }
+
+    std::printf("%d entities, %d cores, median of %d frames\n", NUM_ENTITIES, std::thread::hardware_concurrency(), NUM_FRAMES);
+    for (std::size_t i = 0; i < workerCounts.size(); i++)
+    {
+        std::printf("%3d workers: %8.3f ms/frame, speedup x%.2f\n", workerCounts[i], medianFrameTimes[i], medianFrameTimes[0] / medianFrameTimes[i]);
+    }
+    return 0;
+}
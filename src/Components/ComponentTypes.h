@@ -0,0 +1,37 @@
+#ifndef COMPONENTTYPES_H
+#define COMPONENTTYPES_H
+
+// Defined in ECS.h, the list only needs the names of the component types
+template <typename... TComponents>
+struct ComponentTypeList;
+template <typename TComponent>
+class Shared;
+
+struct TransformComponent;
+struct RigidBodyComponent;
+struct SpriteComponent;
+struct AnimationComponent;
+struct BoxColliderComponent;
+struct KeyboardControlledComponent;
+struct CameraFollowComponent;
+struct HealthComponent;
+struct ProjectileEmitterComponent;
+struct ProjectileComponent;
+
+// Component types with a compile-time id (their position in the list).
+// Types that are not listed still work, they get an id the first time they are used
+typedef ComponentTypeList<
+    TransformComponent,
+    RigidBodyComponent,
+    SpriteComponent,
+    AnimationComponent,
+    BoxColliderComponent,
+    KeyboardControlledComponent,
+    CameraFollowComponent,
+    HealthComponent,
+    ProjectileEmitterComponent,
+    ProjectileComponent,
+    Shared<SpriteComponent>>
+    RegisteredComponentTypes;
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SPRITECOMPONENT_h
 #define SPRITECOMPONENT_h
 
+#include <string>
 #include <SDL2/SDL.h>
 
 struct SpriteComponent
@@ -14,7 +15,7 @@ struct SpriteComponent
 
     SpriteComponent(std::string assetId = "", int width = 1, int height = 1, int zIndex = 0, bool isFixed = false, int srcRectX = 0, int srcRectY = 0)
     {
-        this->assetId = assetId;
+        this->assetId = std::move(assetId);
         this->width = width;
         this->height = height;
         this->zIndex = zIndex;
@@ -1,4 +1,6 @@
 #include "./ECS.h"
+#include <atomic>
+#include <cstdlib>
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // ENTITY
@@ -9,36 +11,63 @@ int Entity::GetId() const
     return id;
 }
 
+std::uint32_t Entity::GetGeneration() const
+{
+    return generation;
+}
+
+EntityHandle Entity::GetHandle() const
+{
+    return (static_cast<EntityHandle>(generation) << 32) | static_cast<std::uint32_t>(id);
+}
+
 void Entity::Kill()
 {
     registry->KillEntity(*this);
 }
 
+bool Entity::IsAlive() const
+{
+    return registry->IsAlive(*this);
+}
+
 bool Entity::operator==(const Entity &other) const
 {
-    return id == other.GetId();
+    return GetHandle() == other.GetHandle();
 }
 
 bool Entity::operator!=(const Entity &other) const
 {
-    return id != other.GetId();
+    return GetHandle() != other.GetHandle();
 }
 
 bool Entity::operator>(const Entity &other) const
 {
-    return id > other.GetId();
+    return GetHandle() > other.GetHandle();
 }
 
 bool Entity::operator<(const Entity &other) const
 {
-    return id > other.GetId();
+    return GetHandle() < other.GetHandle();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // COMPONENT
 ////////////////////////////////////////////////////////////////////////////////////////
 
-int IComponent::nextId = 0;
+std::atomic<int> IComponent::nextId(RegisteredComponentTypes::size);
+
+int IComponent::AssignId()
+{
+    const int id = nextId++;
+    if (id >= static_cast<int>(MAX_COMPONENTS))
+    {
+        // The id would index past the signatures and the archetype columns, there is no way to recover
+        Logger::Err("Component id = ", id, " exceeds the maximum number of component types, raise ECS_MAX_COMPONENTS");
+        std::abort();
+    }
+    return id;
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // SYSTEM
@@ -53,14 +82,42 @@ const std::vector<Entity> &System::GetSystemEntities() const
 
 void System::AddEntity(Entity entity)
 {
+    if (HasEntity(entity))
+    {
+        return;
+    }
+
+    const auto entityId = entity.GetId();
+    if (entityId >= static_cast<int>(entityIdToIndex.size()))
+    {
+        entityIdToIndex.resize(entityId + 1, -1);
+    }
+    entityIdToIndex[entityId] = entities.size();
     entities.push_back(entity);
 }
 
 void System::RemoveEntity(Entity entity)
 {
-    entities.erase(std::remove_if(entities.begin(), entities.end(), [&entity](Entity other)
-                                  { return entity == other; }),
-                   entities.end());
+    if (!HasEntity(entity))
+    {
+        return;
+    }
+
+    // Move the last entity into the removed position, so the removal is O(1)
+    const auto entityId = entity.GetId();
+    const int indexOfRemoved = entityIdToIndex[entityId];
+    const Entity last = entities.back();
+    entities[indexOfRemoved] = last;
+    entityIdToIndex[last.GetId()] = indexOfRemoved;
+
+    entities.pop_back();
+    entityIdToIndex[entityId] = -1;
+}
+
+bool System::HasEntity(Entity entity) const
+{
+    const auto entityId = entity.GetId();
+    return entityId < static_cast<int>(entityIdToIndex.size()) && entityIdToIndex[entityId] != -1;
 }
 
 const Signature &System::GetComponentSignature() const
@@ -68,6 +125,383 @@ const Signature &System::GetComponentSignature() const
     return componentSignature;
 }
 
+const Signature &System::GetExcludeSignature() const
+{
+    return excludeSignature;
+}
+
+bool System::MatchesSignature(const Signature &entityComponentSignature) const
+{
+    // The excluded bits are masked together with the required ones, so a single compare checks both
+    return componentSignature.any() && (entityComponentSignature & (componentSignature | excludeSignature)) == componentSignature;
+}
+
+void System::RequireExclusiveAccess()
+{
+    isExclusive = true;
+}
+
+// Two systems conflict if one of them writes a component the other one reads or writes
+bool System::ConflictsWith(const System &other) const
+{
+    if (isExclusive || other.isExclusive)
+    {
+        return true;
+    }
+    return (writeSignature & (other.readSignature | other.writeSignature)).any() ||
+           (other.writeSignature & readSignature).any();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// ARCHETYPE
+////////////////////////////////////////////////////////////////////////////////////////
+// Entities with the same signature share fixed-size chunks, with one column per component
+////////////////////////////////////////////////////////////////////////////////////////
+
+Archetype::Archetype(const Signature &signature, const std::vector<ComponentTypeInfo> &componentTypeInfos)
+    : signature(signature), componentColumns(MAX_COMPONENTS, -1)
+{
+    // Every row stores the entity id plus one element in each component column
+    std::size_t rowSize = sizeof(int);
+    for (std::size_t componentId = 0; componentId < signature.size(); componentId++)
+    {
+        if (signature.test(componentId))
+        {
+            componentColumns[componentId] = columns.size();
+            columns.push_back({static_cast<int>(componentId), 0, componentTypeInfos[componentId]});
+            rowSize += componentTypeInfos[componentId].size;
+        }
+    }
+
+    // Fit as many rows as possible in a chunk, leaving room for the padding needed to align the columns
+    chunkCapacity = std::max<int>(1, ARCHETYPE_CHUNK_SIZE / rowSize);
+    while (true)
+    {
+        std::size_t offset = sizeof(int) * chunkCapacity;
+        for (auto &column : columns)
+        {
+            const auto alignment = column.typeInfo.alignment;
+            column.offset = (offset + alignment - 1) / alignment * alignment;
+            offset = column.offset + column.typeInfo.size * chunkCapacity;
+        }
+        if (offset <= ARCHETYPE_CHUNK_SIZE || chunkCapacity == 1)
+        {
+            chunkBytes = std::max(offset, ARCHETYPE_CHUNK_SIZE);
+            break;
+        }
+        chunkCapacity--;
+    }
+}
+
+Archetype::~Archetype()
+{
+    for (int chunkIndex = 0; chunkIndex < static_cast<int>(chunks.size()); chunkIndex++)
+    {
+        for (int row = 0; row < chunkSizes[chunkIndex]; row++)
+        {
+            for (const auto &column : columns)
+            {
+                if (!column.typeInfo.isTriviallyCopyable)
+                {
+                    column.typeInfo.destroy(GetAddress(column, {chunkIndex, row}));
+                }
+            }
+        }
+    }
+}
+
+const Signature &Archetype::GetSignature() const
+{
+    return signature;
+}
+
+int Archetype::GetNumChunks() const
+{
+    return chunks.size();
+}
+
+std::size_t Archetype::GetChunkBytes() const
+{
+    return chunkBytes;
+}
+
+int Archetype::GetChunkSize(int chunkIndex) const
+{
+    return chunkSizes[chunkIndex];
+}
+
+ArchetypeRow Archetype::AllocateRow(int entityId)
+{
+    if (chunks.empty() || chunkSizes.back() == chunkCapacity)
+    {
+        // The chunk memory is left uninitialized, the components are constructed in place
+        const auto numElements = (chunkBytes + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+        chunks.push_back(std::unique_ptr<std::max_align_t[]>(new std::max_align_t[numElements]));
+        chunkSizes.push_back(0);
+    }
+
+    ArchetypeRow row = {static_cast<int>(chunks.size()) - 1, chunkSizes.back()};
+    chunkSizes.back()++;
+    GetEntityIds(row.chunkIndex)[row.row] = entityId;
+    return row;
+}
+
+void Archetype::Relocate(const ComponentTypeInfo &typeInfo, void *destination, void *source)
+{
+    if (typeInfo.isTriviallyCopyable)
+    {
+        std::memcpy(destination, source, typeInfo.size);
+        return;
+    }
+    typeInfo.moveConstruct(destination, source);
+    typeInfo.destroy(source);
+}
+
+void Archetype::MoveComponentsFrom(Archetype &source, ArchetypeRow sourceRow, ArchetypeRow row)
+{
+    for (const auto &column : columns)
+    {
+        const int sourceColumn = source.componentColumns[column.componentId];
+        if (sourceColumn != -1)
+        {
+            // The source row is destroyed afterwards, when it is removed from its archetype
+            void *sourceAddress = source.GetAddress(source.columns[sourceColumn], sourceRow);
+            if (column.typeInfo.isTriviallyCopyable)
+            {
+                std::memcpy(GetAddress(column, row), sourceAddress, column.typeInfo.size);
+            }
+            else
+            {
+                column.typeInfo.moveConstruct(GetAddress(column, row), sourceAddress);
+            }
+        }
+    }
+}
+
+int Archetype::RemoveRow(ArchetypeRow row)
+{
+    for (const auto &column : columns)
+    {
+        if (!column.typeInfo.isTriviallyCopyable)
+        {
+            column.typeInfo.destroy(GetAddress(column, row));
+        }
+    }
+
+    // Move the last row into the removed position to keep the chunks packed
+    const ArchetypeRow lastRow = {static_cast<int>(chunks.size()) - 1, chunkSizes.back() - 1};
+    int movedEntityId = -1;
+    if (row.chunkIndex != lastRow.chunkIndex || row.row != lastRow.row)
+    {
+        for (const auto &column : columns)
+        {
+            Relocate(column.typeInfo, GetAddress(column, row), GetAddress(column, lastRow));
+        }
+        movedEntityId = GetEntityIds(lastRow.chunkIndex)[lastRow.row];
+        GetEntityIds(row.chunkIndex)[row.row] = movedEntityId;
+    }
+
+    chunkSizes.back()--;
+    if (chunkSizes.back() == 0)
+    {
+        chunks.pop_back();
+        chunkSizes.pop_back();
+    }
+    return movedEntityId;
+}
+
+Archetype *ArchetypeStorage::GetOrCreateArchetype(const Signature &signature)
+{
+    auto archetype = archetypesBySignature.find(signature);
+    if (archetype != archetypesBySignature.end())
+    {
+        return archetype->second;
+    }
+
+    archetypes.push_back(std::make_unique<Archetype>(signature, componentTypeInfos));
+    archetypesBySignature.emplace(signature, archetypes.back().get());
+    return archetypes.back().get();
+}
+
+void ArchetypeStorage::MoveEntity(int entityId, const Signature &signature)
+{
+    const EntityLocation location = entityLocations[entityId];
+    Archetype *destination = signature.none() ? nullptr : GetOrCreateArchetype(signature);
+
+    EntityLocation newLocation = {destination, {}};
+    if (destination)
+    {
+        newLocation.row = destination->AllocateRow(entityId);
+        if (location.archetype)
+        {
+            destination->MoveComponentsFrom(*location.archetype, location.row, newLocation.row);
+        }
+    }
+    if (location.archetype)
+    {
+        // The last entity of the old archetype takes the place of the entity that left
+        const int movedEntityId = location.archetype->RemoveRow(location.row);
+        if (movedEntityId != -1)
+        {
+            entityLocations[movedEntityId].row = location.row;
+        }
+    }
+    entityLocations[entityId] = newLocation;
+}
+
+void ArchetypeStorage::RemoveComponent(int entityId, int componentId)
+{
+    Signature signature = entityLocations[entityId].archetype->GetSignature();
+    signature.set(componentId, false);
+    MoveEntity(entityId, signature);
+}
+
+void ArchetypeStorage::SetVersion(int componentId, int entityId, std::uint32_t version)
+{
+    if (componentId >= static_cast<int>(componentVersions.size()))
+    {
+        componentVersions.resize(componentId + 1);
+    }
+    auto &versions = componentVersions[componentId];
+    if (entityId >= static_cast<int>(versions.size()))
+    {
+        versions.resize(entityId + 1, 0);
+    }
+    versions[entityId] = version;
+}
+
+std::uint32_t ArchetypeStorage::GetVersion(int componentId, int entityId) const
+{
+    return componentVersions[componentId][entityId];
+}
+
+void ArchetypeStorage::RemoveEntity(int entityId)
+{
+    if (entityId < static_cast<int>(entityLocations.size()) && entityLocations[entityId].archetype)
+    {
+        MoveEntity(entityId, Signature());
+    }
+}
+
+const std::vector<std::unique_ptr<Archetype>> &ArchetypeStorage::GetArchetypes() const
+{
+    return archetypes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// PREFAB
+////////////////////////////////////////////////////////////////////////////////////////
+// Named entity templates, copied into new entities by Registry.Instantiate()
+////////////////////////////////////////////////////////////////////////////////////////
+
+const std::string &Prefab::GetName() const
+{
+    return name;
+}
+
+void Prefab::CopyTo(Registry &registry, Entity entity, const Signature &skipSignature) const
+{
+    for (const auto &prefabComponent : components)
+    {
+        if (!skipSignature.test(prefabComponent.componentId))
+        {
+            prefabComponent.copyTo(registry, entity, prefabComponent.component.get());
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// COMMAND BUFFER
+////////////////////////////////////////////////////////////////////////////////////////
+// Records structural changes from any thread, played back in the next Registry.Update()
+////////////////////////////////////////////////////////////////////////////////////////
+
+CommandBuffer::~CommandBuffer()
+{
+    Clear();
+}
+
+void CommandBuffer::SetSortKey(std::uint64_t sortKey)
+{
+    this->sortKey = sortKey;
+}
+
+Entity CommandBuffer::CreateEntity()
+{
+    Entity entity(-1 - numCreatedEntities);
+    numCreatedEntities++;
+    commands.push_back({CommandType::CreateEntity, sortKey, entity, nullptr, nullptr, nullptr});
+    return entity;
+}
+
+void CommandBuffer::KillEntity(Entity entity)
+{
+    commands.push_back({CommandType::KillEntity, sortKey, entity, nullptr, nullptr, nullptr});
+}
+
+int CommandBuffer::GetNumCommands() const
+{
+    return commands.size();
+}
+
+Entity CommandBuffer::ResolveEntity(Registry &registry, Entity entity)
+{
+    if (entity.GetId() >= 0)
+    {
+        return entity;
+    }
+
+    const int index = -1 - entity.GetId();
+    if (index >= static_cast<int>(createdEntities.size()))
+    {
+        createdEntities.resize(index + 1, Entity(-1));
+    }
+    if (createdEntities[index].GetId() == -1)
+    {
+        createdEntities[index] = registry.CreateEntity();
+    }
+    return createdEntities[index];
+}
+
+void CommandBuffer::Apply(Registry &registry, int commandIndex)
+{
+    const auto &command = commands[commandIndex];
+    const Entity entity = ResolveEntity(registry, command.entity);
+    switch (command.type)
+    {
+    case CommandType::CreateEntity:
+        break;
+    case CommandType::KillEntity:
+        registry.KillEntity(entity);
+        break;
+    case CommandType::AddComponent:
+    case CommandType::RemoveComponent:
+    case CommandType::InstantiatePrefab:
+        // Skip the entities that were killed, before or after the command was recorded
+        if (registry.IsAlive(entity) && !registry.IsBeingKilled(entity))
+        {
+            command.apply(registry, entity, command.payload);
+        }
+        break;
+    }
+}
+
+void CommandBuffer::Clear()
+{
+    for (const auto &command : commands)
+    {
+        if (command.destroyPayload)
+        {
+            command.destroyPayload(command.payload);
+        }
+    }
+    commands.clear();
+    payloads.Reset();
+    sortKey = 0;
+    numCreatedEntities = 0;
+    createdEntities.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 // REGISTRY
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -75,6 +509,8 @@ const Signature &System::GetComponentSignature() const
 // add systems, and components
 ////////////////////////////////////////////////////////////////////////////////////////
 
+std::atomic<int> Registry::nextRegistryId(0);
+
 Entity Registry::CreateEntity()
 {
     int entityId;
@@ -84,6 +520,9 @@ Entity Registry::CreateEntity()
         if (entityId >= static_cast<int>(entityComponentSignatures.size()))
         {
             entityComponentSignatures.resize(entityId + 1);
+            entityGenerations.resize(entityId + 1, 0);
+            entityIsActive.resize(entityId + 1, false);
+            entityIsBeingKilled.resize(entityId + 1, false);
         }
     }
     else
@@ -91,26 +530,99 @@ Entity Registry::CreateEntity()
         entityId = freeIDs.front();
         freeIDs.pop_front();
     }
-    Entity entity(entityId);
+    Entity entity(entityId, entityGenerations[entityId]);
     entity.registry = this;
-    entitiesToBeAdded.insert(entity);
+    entitiesToBeAdded.push_back(entity);
+    numEntitiesCreated++;
     Logger::Log("Entity created with id: ", entityId);
     return entity;
 }
 
+std::vector<Entity> Registry::CreateEntities(int count)
+{
+    std::vector<Entity> entities;
+    entities.reserve(count);
+    entitiesToBeAdded.reserve(entitiesToBeAdded.size() + count);
+
+    // Recycle the free ids first, then grow the entity arrays once for all the new ids
+    while (!freeIDs.empty() && static_cast<int>(entities.size()) < count)
+    {
+        const int entityId = freeIDs.front();
+        freeIDs.pop_front();
+        entities.push_back(Entity(entityId, entityGenerations[entityId]));
+    }
+    const int numNewIds = count - entities.size();
+    if (nextEntityId + numNewIds > static_cast<int>(entityComponentSignatures.size()))
+    {
+        entityComponentSignatures.resize(nextEntityId + numNewIds);
+        entityGenerations.resize(nextEntityId + numNewIds, 0);
+        entityIsActive.resize(nextEntityId + numNewIds, false);
+        entityIsBeingKilled.resize(nextEntityId + numNewIds, false);
+    }
+    for (int i = 0; i < numNewIds; i++)
+    {
+        const int entityId = nextEntityId++;
+        entities.push_back(Entity(entityId, entityGenerations[entityId]));
+    }
+
+    for (auto &entity : entities)
+    {
+        entity.registry = this;
+        entitiesToBeAdded.push_back(entity);
+    }
+    numEntitiesCreated += count;
+    Logger::Log(count, " entities created");
+    return entities;
+}
+
 void Registry::KillEntity(Entity entity)
 {
-    entitiesToBeKilled.insert(entity);
+    // Ignore stale entities (their id may already belong to a different entity), and entities killed twice
+    if (!IsAlive(entity) || entityIsBeingKilled[entity.GetId()])
+    {
+        return;
+    }
+    entityIsBeingKilled[entity.GetId()] = true;
+    entitiesToBeKilled.push_back(entity);
     Logger::Log("Entity killed with id: ", entity.GetId());
 }
 
+std::uint32_t Registry::GetVersion() const
+{
+    return version;
+}
+
+bool Registry::IsAlive(Entity entity) const
+{
+    const auto entityId = entity.GetId();
+    return entityId >= 0 && entityId < static_cast<int>(entityGenerations.size()) && entityGenerations[entityId] == entity.GetGeneration();
+}
+
+bool Registry::IsBeingKilled(Entity entity) const
+{
+    return IsAlive(entity) && entityIsBeingKilled[entity.GetId()];
+}
+
+Entity Registry::GetEntity(EntityHandle handle)
+{
+    Entity entity(static_cast<int>(handle & 0xFFFFFFFF), static_cast<std::uint32_t>(handle >> 32));
+    entity.registry = this;
+    return entity;
+}
+
+Entity Registry::GetEntityById(int entityId)
+{
+    Entity entity(entityId, entityGenerations[entityId]);
+    entity.registry = this;
+    return entity;
+}
+
 void Registry::AddEntityToSystems(Entity entity)
 {
     const auto entityComponentSignature = entityComponentSignatures[entity.GetId()];
     for (const auto &system : systems)
     {
-        const auto &systemComponentSignature = system.second->GetComponentSignature();
-        if ((entityComponentSignature & systemComponentSignature) == systemComponentSignature)
+        if (system.second->MatchesSignature(entityComponentSignature))
         {
             system.second->AddEntity(entity);
         }
@@ -125,15 +637,327 @@ void Registry::RemoveEntityFromSystems(Entity entity)
     }
 }
 
+void Registry::AddSystemToComponentSystems(System *system)
+{
+    // Adding or removing an excluded component changes the membership as well
+    const auto systemSignature = system->GetComponentSignature() | system->GetExcludeSignature();
+    for (std::size_t componentId = 0; componentId < systemSignature.size(); componentId++)
+    {
+        if (systemSignature.test(componentId))
+        {
+            if (componentId >= componentSystems.size())
+            {
+                componentSystems.resize(componentId + 1);
+            }
+            componentSystems[componentId].push_back(system);
+        }
+    }
+}
+
+void Registry::RemoveSystemFromComponentSystems(System *system)
+{
+    for (auto &componentSystemList : componentSystems)
+    {
+        componentSystemList.erase(std::remove(componentSystemList.begin(), componentSystemList.end(), system), componentSystemList.end());
+    }
+}
+
+// When the signature of an entity that is already in the systems changes, only the systems
+// that require or exclude the changed component can gain or lose that entity
+void Registry::OnComponentAdded(Entity entity, int componentId)
+{
+    if (componentId < static_cast<int>(componentGroups.size()))
+    {
+        for (auto group : componentGroups[componentId])
+        {
+            group->OnComponentAdded(entity.GetId(), entityComponentSignatures[entity.GetId()]);
+        }
+    }
+
+    // Entities awaiting creation are matched against all the systems in the next Registry.Update()
+    if (!entityIsActive[entity.GetId()] || componentId >= static_cast<int>(componentSystems.size()))
+    {
+        return;
+    }
+    UpdateEntityInSystems(entity, componentSystems[componentId]);
+}
+
+void Registry::OnComponentRemoved(Entity entity, int componentId)
+{
+    if (!entityIsActive[entity.GetId()] || componentId >= static_cast<int>(componentSystems.size()))
+    {
+        return;
+    }
+    UpdateEntityInSystems(entity, componentSystems[componentId]);
+}
+
+void Registry::RemoveEntityFromGroups(int entityId, int componentId)
+{
+    if (componentId >= static_cast<int>(componentGroups.size()))
+    {
+        return;
+    }
+    for (auto group : componentGroups[componentId])
+    {
+        group->OnComponentRemoved(entityId);
+    }
+}
+
+void Registry::UpdateEntityInSystems(Entity entity, const std::vector<System *> &systemsToUpdate)
+{
+    const auto &entityComponentSignature = entityComponentSignatures[entity.GetId()];
+    for (auto system : systemsToUpdate)
+    {
+        if (system->MatchesSignature(entityComponentSignature))
+        {
+            system->AddEntity(entity);
+        }
+        else
+        {
+            system->RemoveEntity(entity);
+        }
+    }
+}
+
+// Prefabs are registered once (usually while loading a level) and live as long as the registry
+Prefab &Registry::RegisterPrefab(const std::string &name)
+{
+    auto &prefab = prefabs[name];
+    if (prefab)
+    {
+        Logger::Warn("Prefab ", name, " was already registered");
+        return *prefab;
+    }
+    prefab = std::make_unique<Prefab>(name);
+    Logger::Log("Prefab ", name, " was registered");
+    return *prefab;
+}
+
+const Prefab &Registry::GetPrefab(const std::string &name) const
+{
+    return *prefabs.at(name);
+}
+
+bool Registry::HasPrefab(const std::string &name) const
+{
+    return prefabs.find(name) != prefabs.end();
+}
+
+void Registry::RemoveSystemFromSchedule(System *system)
+{
+    schedule.erase(std::remove_if(schedule.begin(), schedule.end(), [system](const ScheduledSystem &scheduledSystem)
+                                  { return scheduledSystem.system == system; }),
+                   schedule.end());
+
+    // The indices of the remaining systems changed, compute their dependencies again in schedule order
+    for (std::size_t i = 0; i < schedule.size(); i++)
+    {
+        schedule[i].dependents.clear();
+        schedule[i].numDependencies = 0;
+        for (std::size_t j = 0; j < i; j++)
+        {
+            if (schedule[j].system->ConflictsWith(*schedule[i].system))
+            {
+                schedule[j].dependents.push_back(i);
+                schedule[i].numDependencies++;
+            }
+        }
+    }
+}
+
+// Runs all the scheduled systems on the thread pool, each one as soon as all the
+// systems it depends on are done. The calling thread helps until every system has finished
+void Registry::RunScheduledSystems(std::unique_ptr<ThreadPool> &threadPool)
+{
+    std::vector<std::atomic<int>> remainingDependencies(schedule.size());
+    for (std::size_t i = 0; i < schedule.size(); i++)
+    {
+        remainingDependencies[i] = schedule[i].numDependencies;
+    }
+    std::atomic<int> numRemainingSystems(schedule.size());
+
+    std::function<void(int)> runSystem = [&](int index)
+    {
+        schedule[index].update();
+
+        // Release the systems that were waiting for this one
+        for (auto dependent : schedule[index].dependents)
+        {
+            if (--remainingDependencies[dependent] == 0)
+            {
+                threadPool->Enqueue([&runSystem, dependent]()
+                                    { runSystem(dependent); });
+            }
+        }
+        numRemainingSystems--;
+    };
+
+    for (std::size_t i = 0; i < schedule.size(); i++)
+    {
+        if (schedule[i].numDependencies == 0)
+        {
+            threadPool->Enqueue([&runSystem, i]()
+                                { runSystem(i); });
+        }
+    }
+    threadPool->WaitForCounter(numRemainingSystems);
+}
+
+CommandBuffer &Registry::GetCommandBuffer()
+{
+    // Every thread caches the buffer it got from the last registry it used
+    static thread_local int cachedRegistryId = -1;
+    static thread_local CommandBuffer *cachedCommandBuffer = nullptr;
+    if (cachedRegistryId == registryId)
+    {
+        return *cachedCommandBuffer;
+    }
+
+    // Look for the buffer the thread got before switching registries, so it only gets one
+    const auto threadId = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(commandBuffersMutex);
+    auto commandBuffer = std::find_if(commandBuffers.begin(), commandBuffers.end(), [threadId](const std::unique_ptr<CommandBuffer> &commandBuffer)
+                                      { return commandBuffer->threadId == threadId; });
+    if (commandBuffer == commandBuffers.end())
+    {
+        commandBuffers.push_back(std::make_unique<CommandBuffer>());
+        commandBuffers.back()->threadId = threadId;
+        commandBuffer = commandBuffers.end() - 1;
+    }
+    cachedRegistryId = registryId;
+    cachedCommandBuffer = commandBuffer->get();
+    return *cachedCommandBuffer;
+}
+
+// Plays back the commands of all the buffers, sorted by (sort key, buffer, record order)
+void Registry::PlaybackCommandBuffers()
+{
+    sortedCommands.clear();
+    for (int bufferIndex = 0; bufferIndex < static_cast<int>(commandBuffers.size()); bufferIndex++)
+    {
+        const auto &commandBuffer = *commandBuffers[bufferIndex];
+        for (int commandIndex = 0; commandIndex < commandBuffer.GetNumCommands(); commandIndex++)
+        {
+            sortedCommands.push_back({commandBuffer.commands[commandIndex].sortKey, bufferIndex, commandIndex});
+        }
+    }
+    if (sortedCommands.empty())
+    {
+        return;
+    }
+
+    std::sort(sortedCommands.begin(), sortedCommands.end(), [](const SortedCommand &a, const SortedCommand &b)
+              { return std::tie(a.sortKey, a.bufferIndex, a.commandIndex) < std::tie(b.sortKey, b.bufferIndex, b.commandIndex); });
+    for (const auto &sortedCommand : sortedCommands)
+    {
+        commandBuffers[sortedCommand.bufferIndex]->Apply(*this, sortedCommand.commandIndex);
+    }
+    for (auto &commandBuffer : commandBuffers)
+    {
+        commandBuffer->Clear();
+    }
+}
+
+// Queues a staging registry filled on another thread, its entities join this one in Update
+void Registry::Merge(std::unique_ptr<Registry> stagingRegistry)
+{
+    // Dropping the staging entities would silently lose a whole level, so this can't be recovered from
+    if (archetypeStorage || stagingRegistry->archetypeStorage)
+    {
+        Logger::Err("Only registries with pool storage can be merged");
+        std::abort();
+    }
+    std::lock_guard<std::mutex> lock(stagingRegistriesMutex);
+    stagingRegistries.push_back(std::move(stagingRegistry));
+}
+
+// Merges the staging registries queued since the last Update
+void Registry::MergeStagingRegistries()
+{
+    std::vector<std::unique_ptr<Registry>> registriesToMerge;
+    {
+        std::lock_guard<std::mutex> lock(stagingRegistriesMutex);
+        registriesToMerge.swap(stagingRegistries);
+    }
+    for (auto &stagingRegistry : registriesToMerge)
+    {
+        MergeRegistry(*stagingRegistry);
+    }
+}
+
+// Moves all the entities of the staging registry into this one, one pool at a time
+void Registry::MergeRegistry(Registry &stagingRegistry)
+{
+    // Apply the changes that are still pending in the staging registry
+    stagingRegistry.Update();
+
+    // Give every live entity of the staging registry a new id in this registry
+    std::vector<bool> isFree(stagingRegistry.nextEntityId, false);
+    for (auto entityId : stagingRegistry.freeIDs)
+    {
+        isFree[entityId] = true;
+    }
+    std::vector<int> stagingEntityIds;
+    for (int entityId = 0; entityId < stagingRegistry.nextEntityId; entityId++)
+    {
+        if (!isFree[entityId])
+        {
+            stagingEntityIds.push_back(entityId);
+        }
+    }
+    const std::vector<Entity> entities = CreateEntities(stagingEntityIds.size());
+    std::vector<int> entityIdMap(stagingRegistry.nextEntityId, -1);
+    for (std::size_t i = 0; i < entities.size(); i++)
+    {
+        entityIdMap[stagingEntityIds[i]] = entities[i].GetId();
+        entityComponentSignatures[entities[i].GetId()] = stagingRegistry.entityComponentSignatures[stagingEntityIds[i]];
+    }
+
+    // Splice the components pool by pool, the pools that don't exist here yet are created empty
+    for (std::size_t componentId = 0; componentId < stagingRegistry.componentPools.size(); componentId++)
+    {
+        const auto &stagingPool = stagingRegistry.componentPools[componentId];
+        if (!stagingPool)
+        {
+            continue;
+        }
+        if (componentId >= componentPools.size())
+        {
+            componentPools.resize(componentId + 1, nullptr);
+        }
+        if (!componentPools[componentId])
+        {
+            componentPools[componentId] = stagingPool->CreateEmpty();
+        }
+        stagingPool->MoveComponentsTo(*componentPools[componentId], entityIdMap, version);
+    }
+
+    // The new entities join the groups now, and the systems with the rest of entitiesToBeAdded
+    for (const auto &group : groups)
+    {
+        for (const auto &entity : entities)
+        {
+            group.second->OnComponentAdded(entity.GetId(), entityComponentSignatures[entity.GetId()]);
+        }
+    }
+
+    Logger::Log("Merged ", entities.size(), " entities from a staging registry");
+}
+
 // Here is where we actually insert/delete the entities that are waiting to be added/removed.
 // We do this because we don't want to confuse our Systems by adding/removing entities in the middle
 // of the frame logic. Therefore, we wait until the end of the frame to update and perform the
 // creation and deletion of entities.
 void Registry::Update()
 {
+    // Apply the structural changes the systems recorded during the frame
+    PlaybackCommandBuffers();
+    MergeStagingRegistries();
+
     for (auto entity : entitiesToBeAdded)
     {
         AddEntityToSystems(entity);
+        entityIsActive[entity.GetId()] = true;
     }
     entitiesToBeAdded.clear();
 
@@ -141,7 +965,100 @@ void Registry::Update()
     {
         RemoveEntityFromSystems(entity);
         entityComponentSignatures[entity.GetId()].reset();
+        entityIsActive[entity.GetId()] = false;
+        entityIsBeingKilled[entity.GetId()] = false;
+
+        // Remove the entity from the component pools (or its archetype)
+        if (archetypeStorage)
+        {
+            archetypeStorage->RemoveEntity(entity.GetId());
+        }
+        for (const auto &group : groups)
+        {
+            group.second->OnComponentRemoved(entity.GetId());
+        }
+        for (const auto &pool : componentPools)
+        {
+            if (pool)
+            {
+                pool->RemoveEntityFromPool(entity.GetId());
+            }
+        }
+
+        // Bump the generation so that any copy of the killed entity becomes stale
+        entityGenerations[entity.GetId()]++;
         freeIDs.push_back(entity.GetId());
     }
+    numEntitiesKilled += entitiesToBeKilled.size();
     entitiesToBeKilled.clear();
+
+    // The frame ends here for the churn counters too
+    lastFrameEntitiesCreated = numEntitiesCreated;
+    lastFrameEntitiesKilled = numEntitiesKilled;
+    numEntitiesCreated = 0;
+    numEntitiesKilled = 0;
+
+    // Start a new version, the changes made from now on belong to the next frame
+    version++;
+}
+
+RegistryStats Registry::GetStats() const
+{
+    RegistryStats stats;
+    stats.numEntities = nextEntityId - freeIDs.size();
+    stats.numFreeIds = freeIDs.size();
+    stats.numEntitiesCreated = lastFrameEntitiesCreated;
+    stats.numEntitiesKilled = lastFrameEntitiesKilled;
+    stats.entityBytes = entityComponentSignatures.capacity() * sizeof(Signature) +
+                        entityGenerations.capacity() * sizeof(std::uint32_t) +
+                        (entityIsActive.capacity() + entityIsBeingKilled.capacity()) / 8;
+
+    for (std::size_t componentId = 0; componentId < componentPools.size(); componentId++)
+    {
+        if (componentPools[componentId])
+        {
+            PoolStats poolStats = componentPools[componentId]->GetStats();
+            poolStats.componentId = componentId;
+            stats.poolBytes += poolStats.bytes;
+            stats.pools.push_back(poolStats);
+        }
+    }
+
+    if (archetypeStorage)
+    {
+        for (const auto &archetype : archetypeStorage->GetArchetypes())
+        {
+            stats.numArchetypes++;
+            stats.numChunks += archetype->GetNumChunks();
+            stats.archetypeBytes += archetype->GetNumChunks() * archetype->GetChunkBytes();
+        }
+    }
+
+    for (const auto &system : systems)
+    {
+        stats.systems.push_back({system.first.name(), static_cast<int>(system.second->GetSystemEntities().size())});
+    }
+    return stats;
+}
+
+void Registry::LogStats() const
+{
+    const RegistryStats stats = GetStats();
+    Logger::Log("Registry: ", stats.numEntities, " entities (", stats.numFreeIds, " free ids), ",
+                stats.numEntitiesCreated, " created and ", stats.numEntitiesKilled, " killed last frame, ",
+                stats.entityBytes, " bytes of entity data");
+    for (const auto &pool : stats.pools)
+    {
+        Logger::Log("Pool ", pool.componentName, " (id = ", pool.componentId, "): ", pool.size, "/", pool.capacity,
+                    " components, ", pool.unusedComponentSlots, " unused slots, ", pool.unusedSparseSlots,
+                    " unused sparse slots, ", pool.bytes, " bytes");
+    }
+    if (archetypeStorage)
+    {
+        Logger::Log("Archetypes: ", stats.numArchetypes, " archetypes, ", stats.numChunks, " chunks, ", stats.archetypeBytes, " bytes");
+    }
+    for (const auto &system : stats.systems)
+    {
+        Logger::Log("System ", system.systemName, ": ", system.numEntities, " entities");
+    }
 }
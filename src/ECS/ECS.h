@@ -1,40 +1,205 @@
 #ifndef ECS_H
 #define ECS_H
 
-#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
 #include <vector>
+#include <string>
 #include <unordered_map>
-#include <set>
 #include <deque>
 #include <algorithm>
 #include <memory>
 #include <typeindex>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include "../Logger/Logger.h"
+#include "../ThreadPool/ThreadPool.h"
+#include "../Memory/LinearArena.h"
+#include "../Components/ComponentTypes.h"
 
-const unsigned int MAX_COMPONENTS = 32;
+// Maximum number of component types, it can be raised at build time (e.g. -DECS_MAX_COMPONENTS=256)
+#ifndef ECS_MAX_COMPONENTS
+#define ECS_MAX_COMPONENTS 64
+#endif
+const unsigned int MAX_COMPONENTS = ECS_MAX_COMPONENTS;
+
+// The parallel loops over entities split the work in tasks of PARALLEL_EACH_CHUNK_SIZE entities
+// (a few KB of component data each), and lists smaller than PARALLEL_EACH_MIN_ENTITIES are
+// processed on the calling thread, as the overhead of the tasks would outweigh the gain:
+// moving an entity takes ~4.5 ns, and waking a worker up a few microseconds, which only
+// ~4k entities split over 2 cores make up for (benchmark/ParallelEachBenchmark.cpp).
+// The threshold can be changed at build time (e.g. -DECS_PARALLEL_EACH_MIN_ENTITIES=0 always
+// splits the work)
+#ifndef ECS_PARALLEL_EACH_MIN_ENTITIES
+#define ECS_PARALLEL_EACH_MIN_ENTITIES 4096
+#endif
+const int PARALLEL_EACH_CHUNK_SIZE = 1024;
+const int PARALLEL_EACH_MIN_ENTITIES = ECS_PARALLEL_EACH_MIN_ENTITIES;
 ////////////////////////////////////////////////////////////////////////////////////////
 // SIGNATURE
 ////////////////////////////////////////////////////////////////////////////////////////
 // We use a bitset (1s and 0s) to keep track of which components an entity has,
 // and also helps keep track of which entities a given system is interested in.
 ////////////////////////////////////////////////////////////////////////////////////////
-typedef std::bitset<MAX_COMPONENTS> Signature;
+
+// Fixed-size bitset stored in 64-bit words. The operations are plain loops over the
+// words without branches, which the compiler unrolls and vectorizes, so comparing
+// signatures stays cheap with hundreds of component types
+template <std::size_t NumBits>
+class BitMask
+{
+private:
+    static const std::size_t NUM_WORDS = (NumBits + 63) / 64;
+    std::uint64_t words[NUM_WORDS] = {};
+
+public:
+    constexpr std::size_t size() const
+    {
+        return NumBits;
+    }
+
+    // Out of range bits are only checked in debug builds, component ids are checked when assigned
+    constexpr bool test(std::size_t bit) const
+    {
+        assert(bit < NumBits);
+        return (words[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    constexpr BitMask &set(std::size_t bit, bool value = true)
+    {
+        assert(bit < NumBits);
+        const std::uint64_t mask = std::uint64_t(1) << (bit % 64);
+        words[bit / 64] = value ? words[bit / 64] | mask : words[bit / 64] & ~mask;
+        return *this;
+    }
+
+    constexpr BitMask &reset()
+    {
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            words[i] = 0;
+        }
+        return *this;
+    }
+
+    constexpr bool any() const
+    {
+        std::uint64_t bits = 0;
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            bits |= words[i];
+        }
+        return bits != 0;
+    }
+
+    constexpr bool none() const
+    {
+        return !any();
+    }
+
+    constexpr BitMask &operator&=(const BitMask &other)
+    {
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            words[i] &= other.words[i];
+        }
+        return *this;
+    }
+
+    constexpr BitMask &operator|=(const BitMask &other)
+    {
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            words[i] |= other.words[i];
+        }
+        return *this;
+    }
+
+    constexpr BitMask operator&(const BitMask &other) const
+    {
+        BitMask result = *this;
+        return result &= other;
+    }
+
+    constexpr BitMask operator|(const BitMask &other) const
+    {
+        BitMask result = *this;
+        return result |= other;
+    }
+
+    constexpr bool operator==(const BitMask &other) const
+    {
+        std::uint64_t difference = 0;
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            difference |= words[i] ^ other.words[i];
+        }
+        return difference == 0;
+    }
+
+    constexpr bool operator!=(const BitMask &other) const
+    {
+        return !(*this == other);
+    }
+
+    std::size_t Hash() const
+    {
+        std::uint64_t hash = 0;
+        for (std::size_t i = 0; i < NUM_WORDS; i++)
+        {
+            hash = (hash ^ words[i]) * 0x100000001b3ull;
+        }
+        return static_cast<std::size_t>(hash ^ (hash >> 32));
+    }
+};
+
+namespace std
+{
+    template <std::size_t NumBits>
+    struct hash<BitMask<NumBits>>
+    {
+        std::size_t operator()(const BitMask<NumBits> &bitMask) const
+        {
+            return bitMask.Hash();
+        }
+    };
+}
+
+typedef BitMask<MAX_COMPONENTS> Signature;
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // ENTITY
 ////////////////////////////////////////////////////////////////////////////////////////
+// An entity is an index (used to look up its components) plus a generation.
+// Every time an index is recycled the generation is incremented, so an old
+// entity that is kept around after being killed can be detected as stale.
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Packed 64-bit handle [upper 32 bits = generation, lower 32 bits = index]
+typedef std::uint64_t EntityHandle;
 
 class Entity
 {
 private:
     int id;
+    std::uint32_t generation;
 
 public:
-    Entity(int id) : id(id) {};
+    Entity(int id, std::uint32_t generation = 0) : id(id), generation(generation) {};
     Entity(const Entity &entity) = default;
     int GetId() const;
+    std::uint32_t GetGeneration() const;
+    EntityHandle GetHandle() const;
 
     void Kill();
+    bool IsAlive() const;
 
     Entity &operator=(const Entity &other) = default;
     bool operator==(const Entity &other) const;
@@ -50,40 +215,48 @@ public:
     bool HasComponent() const;
     template <typename TComponent>
     TComponent &GetComponent() const;
+    // Same as GetComponent, but flags the component as changed in the current frame
+    template <typename TComponent>
+    TComponent &GetMutableComponent() const;
 
     // Hold a pointer to the entity's owner registry
-    class Registry *registry;
+    class Registry *registry = nullptr;
 };
 
-template <typename TComponent, typename... TArgs>
-void Entity::AddComponent(TArgs &&...args)
-{
-    registry->template AddComponent<TComponent>(*this, std::forward<TArgs>(args)...);
-}
-template <typename TComponent>
-void Entity::RemoveComponent()
-{
-    registry->template RemoveComponent<TComponent>(*this);
-}
-template <typename TComponent>
-bool Entity::HasComponent() const
-{
-    return registry->template HasComponent<TComponent>(*this);
-}
-template <typename TComponent>
-TComponent &Entity::GetComponent() const
-{
-    return registry->template GetComponent<TComponent>(*this);
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////
 // COMPONENT
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// List of component types, the position of a type in the list is its id
+template <typename... TComponents>
+struct ComponentTypeList
+{
+    static constexpr int size = sizeof...(TComponents);
+
+    // Position of the component type in the list (-1 = not in the list)
+    template <typename TComponent>
+    static constexpr int IndexOf()
+    {
+        constexpr bool isSame[] = {std::is_same<TComponent, TComponents>::value..., false};
+        for (int i = 0; i < size; i++)
+        {
+            if (isSame[i])
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+static_assert(RegisteredComponentTypes::size <= static_cast<int>(MAX_COMPONENTS), "Too many registered component types, raise ECS_MAX_COMPONENTS");
+
 struct IComponent
 {
 protected:
-    static int nextId;
+    // The ids assigned at runtime start after the ones of RegisteredComponentTypes
+    static std::atomic<int> nextId;
+    static int AssignId();
 };
 
 // Used to assign a unique ID to a component type
@@ -91,42 +264,141 @@ template <typename TComponent>
 class Component : public IComponent
 {
 public:
+    // Compile-time ID of the types listed in RegisteredComponentTypes (-1 for the other types)
+    static constexpr int staticId = RegisteredComponentTypes::template IndexOf<TComponent>();
+
     // Returns the unique ID of Component<T>
     static int GetId()
     {
-        // A static local variable is initialized only once and retains its value between function calls
-        static auto id = nextId++;
-        return id;
+        if constexpr (staticId != -1)
+        {
+            return staticId;
+        }
+        else
+        {
+            // A static local variable is initialized only once and retains its value between function calls
+            static auto id = AssignId();
+            return id;
+        }
+    }
+};
+
+// Signature with the bits of the given component types, folded at compile time when they are all registered
+template <typename... TComponents>
+Signature MakeSignature()
+{
+    if constexpr (((Component<TComponents>::staticId != -1) && ...))
+    {
+        constexpr Signature signature = [] {
+            Signature result;
+            (result.set(Component<TComponents>::staticId), ...);
+            return result;
+        }();
+        return signature;
+    }
+    else
+    {
+        Signature signature;
+        (signature.set(Component<TComponents>::GetId()), ...);
+        return signature;
     }
+}
+
+// Components without data members (e.g. CameraFollowComponent) are tags. They are detected
+// at compile time and stored only as a bit in the entity signature, without a pool
+template <typename TComponent>
+struct IsTagComponent : std::is_empty<TComponent>
+{
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // SYSTEM
 ////////////////////////////////////////////////////////////////////////////////////////
-// The system processes entities that contain a specific signature
+// The system processes entities that contain a specific signature, and optionally
+// none of the components of an exclusion signature
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// Tags that declare how a system accesses a component, so the systems that don't
+// conflict can run in parallel. Example: RequireComponent<Reads<RigidBodyComponent>>()
+// A component without a tag is treated as written.
+template <typename TComponent>
+struct Reads
+{
+};
+
+template <typename TComponent>
+struct Writes
+{
+};
+
+template <typename TAccess>
+struct ComponentAccess
+{
+    typedef TAccess Type;
+    static const bool isWrite = true;
+};
+
+template <typename TComponent>
+struct ComponentAccess<Reads<TComponent>>
+{
+    typedef TComponent Type;
+    static const bool isWrite = false;
+};
+
+template <typename TComponent>
+struct ComponentAccess<Writes<TComponent>>
+{
+    typedef TComponent Type;
+    static const bool isWrite = true;
+};
+
 class System
 {
 private:
     Signature componentSignature;
+    // Entities with any of these components are skipped, even if they match componentSignature
+    Signature excludeSignature;
+    // Components the system reads or writes, including the ones it doesn't require
+    Signature readSignature;
+    Signature writeSignature;
+    // Exclusive systems make structural changes (create/kill entities) and never run in parallel
+    bool isExclusive = false;
     std::vector<Entity> entities;
+    // Sparse lookup of the position of an entity in the entities vector (-1 = not in the system)
+    // [Vector index = entity id]
+    std::vector<int> entityIdToIndex;
 
 protected:
-    template <typename TComponent>
+    template <typename TAccess>
     void RequireComponent();
+    // Declares the access to a component the system uses without requiring it. A system that requires
+    // no component (e.g. it only iterates views) keeps no entities
+    template <typename TAccess>
+    void AccessComponent();
+    // Example: RequireComponent<TransformComponent>(); ExcludeComponent<ProjectileComponent>();
+    template <typename TComponent>
+    void ExcludeComponent();
+    void RequireExclusiveAccess();
 
 public:
     System() = default;
     ~System() = default;
     void AddEntity(Entity entity);
     const std::vector<Entity> &GetSystemEntities() const;
+    // Calls func(Entity) for all the system entities, in parallel chunks when there are many of them
+    template <typename TFunc>
+    void ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const;
     void RemoveEntity(Entity entity);
+    bool HasEntity(Entity entity) const;
     template <typename TComponent>
     void AddComponent(Component<TComponent> component);
     template <typename TComponent>
     void RemoveComponent(Component<TComponent> component);
     const Signature &GetComponentSignature() const;
+    const Signature &GetExcludeSignature() const;
+    // True if an entity with the given signature belongs to the system
+    bool MatchesSignature(const Signature &entityComponentSignature) const;
+    bool ConflictsWith(const System &other) const;
 };
 
 template <typename TComponent>
@@ -141,209 +413,1747 @@ void System::RemoveComponent(Component<TComponent> component)
     componentSignature.set(component.GetId(), false);
 }
 
-template <typename TComponent>
+template <typename TAccess>
 void System::RequireComponent()
 {
-    const auto componentId = Component<TComponent>::GetId();
+    const auto componentId = Component<typename ComponentAccess<TAccess>::Type>::GetId();
     componentSignature.set(componentId);
+    AccessComponent<TAccess>();
+}
+
+template <typename TComponent>
+void System::ExcludeComponent()
+{
+    excludeSignature.set(Component<TComponent>::GetId());
+}
+
+template <typename TFunc>
+void System::ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const
+{
+    if (static_cast<int>(entities.size()) < PARALLEL_EACH_MIN_ENTITIES)
+    {
+        for (auto entity : entities)
+        {
+            func(entity);
+        }
+        return;
+    }
+
+    threadPool->ParallelFor(entities.size(), PARALLEL_EACH_CHUNK_SIZE, [this, &func](int begin, int end)
+                            {
+        for (int i = begin; i < end; i++)
+        {
+            func(entities[i]);
+        } });
+}
+
+template <typename TAccess>
+void System::AccessComponent()
+{
+    const auto componentId = Component<typename ComponentAccess<TAccess>::Type>::GetId();
+    if (ComponentAccess<TAccess>::isWrite)
+    {
+        writeSignature.set(componentId);
+    }
+    else
+    {
+        readSignature.set(componentId);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // POOL
 ////////////////////////////////////////////////////////////////////////////////////////
-// A pool is just a vector (continguous data) of objects of type TComponent
+// A pool is a sparse set of objects of type TComponent. The components are kept
+// tightly packed (contiguous data) in the dense array, and a sparse array maps each
+// entity id to the index of its component, so add/remove/has are all O(1)
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// Size in bytes of a page of components. Pools grow one page at a time, and growing doesn't
+// relocate the components that are already stored, so it has a fixed cost
+const std::size_t POOL_PAGE_SIZE = 16 * 1024;
+// Number of entity ids covered by a page of the sparse array
+const int POOL_SPARSE_PAGE_SIZE = 4096;
+
+// Memory usage of a pool, see Registry.GetStats()
+struct PoolStats
+{
+    int componentId = -1;
+    const char *componentName = "";
+    std::size_t componentSize = 0;
+    // Live components, and the components that fit in the allocated pages
+    int size = 0;
+    int capacity = 0;
+    // Allocated but unused component slots and sparse array entries
+    int unusedComponentSlots = 0;
+    int unusedSparseSlots = 0;
+    // Component pages, dense arrays and sparse pages
+    std::size_t bytes = 0;
+};
+
 class IPool
 {
 public:
     virtual ~IPool() {}
+    virtual void RemoveEntityFromPool(int entityId) = 0;
+    // Empty pool of the same component type
+    virtual std::shared_ptr<IPool> CreateEmpty() const = 0;
+    // Moves all the components into target (a pool of the same type), the component of
+    // entity id goes to entity entityIdMap[id] and is stamped with version
+    virtual void MoveComponentsTo(IPool &target, const std::vector<int> &entityIdMap, std::uint32_t version) = 0;
+    virtual PoolStats GetStats() const = 0;
 };
 
 template <typename TComponent>
 class Pool : public IPool
 {
 private:
-    std::vector<TComponent> data;
+    // Components per page, rounded down to a power of two so the page lookup is a shift and a mask
+    static constexpr int GetComponentsPerPage()
+    {
+        int componentsPerPage = 1;
+        while (componentsPerPage * 2 * sizeof(TComponent) <= POOL_PAGE_SIZE)
+        {
+            componentsPerPage *= 2;
+        }
+        return componentsPerPage;
+    }
+    static constexpr int COMPONENTS_PER_PAGE = GetComponentsPerPage();
+
+    // Dense storage, only the components that exist are stored here. It is split in pages
+    // of uninitialized memory where the components are constructed in place (even move-only ones)
+    // [data index = component index]
+    std::vector<TComponent *> pages;
+    int size = 0;
+    std::vector<int> indexToEntityId;
+    // Registry version in which each component was added or last changed
+    // [vector index = component index]
+    std::vector<std::uint32_t> versions;
+
+    // Sparse array to find the index of the component of a given entity (-1 = none).
+    // Its pages are allocated the first time an entity id in their range gets a component
+    // [page index = entity id / POOL_SPARSE_PAGE_SIZE]
+    std::vector<std::unique_ptr<int[]>> sparsePages;
+
+    TComponent *GetAddress(int index) const
+    {
+        return pages[index / COMPONENTS_PER_PAGE] + index % COMPONENTS_PER_PAGE;
+    }
+
+    int GetIndex(int entityId) const
+    {
+        return sparsePages[entityId / POOL_SPARSE_PAGE_SIZE][entityId % POOL_SPARSE_PAGE_SIZE];
+    }
+
+    void AllocatePages(int capacity)
+    {
+        while (static_cast<int>(pages.size()) * COMPONENTS_PER_PAGE < capacity)
+        {
+            pages.push_back(std::allocator<TComponent>().allocate(COMPONENTS_PER_PAGE));
+        }
+    }
+
+    void SetIndex(int entityId, int index)
+    {
+        const int pageIndex = entityId / POOL_SPARSE_PAGE_SIZE;
+        if (pageIndex >= static_cast<int>(sparsePages.size()))
+        {
+            sparsePages.resize(pageIndex + 1);
+        }
+        if (!sparsePages[pageIndex])
+        {
+            sparsePages[pageIndex].reset(new int[POOL_SPARSE_PAGE_SIZE]);
+            std::fill_n(sparsePages[pageIndex].get(), POOL_SPARSE_PAGE_SIZE, -1);
+        }
+        sparsePages[pageIndex][entityId % POOL_SPARSE_PAGE_SIZE] = index;
+    }
 
 public:
-    Pool(int size)
+    Pool(int capacity = 100)
     {
-        data.resize(size);
+        Reserve(capacity);
     }
 
-    virtual ~Pool() = default;
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    virtual ~Pool()
+    {
+        Clear();
+        for (auto page : pages)
+        {
+            std::allocator<TComponent>().deallocate(page, COMPONENTS_PER_PAGE);
+        }
+    }
 
     bool isEmpty() const
     {
-        return data.empty();
+        return size == 0;
     }
 
     int GetSize() const
     {
-        return data.size();
+        return size;
     }
 
-    void Resize(int n)
+    // Allocates the memory needed to hold the given number of components
+    void Reserve(int capacity)
     {
-        data.resize(n);
+        AllocatePages(capacity);
+        indexToEntityId.reserve(capacity);
+        versions.reserve(capacity);
     }
 
+    // Destroys all the components, the pages are kept to be reused
     void Clear()
     {
-        data.clear();
+        for (int i = 0; i < size; i++)
+        {
+            GetAddress(i)->~TComponent();
+        }
+        size = 0;
+        indexToEntityId.clear();
+        versions.clear();
+        sparsePages.clear();
     }
 
-    void Add(TComponent object)
+    bool Has(int entityId) const
     {
-        data.push_back(object);
+        const int pageIndex = entityId / POOL_SPARSE_PAGE_SIZE;
+        return pageIndex < static_cast<int>(sparsePages.size()) && sparsePages[pageIndex] &&
+               sparsePages[pageIndex][entityId % POOL_SPARSE_PAGE_SIZE] != -1;
     }
 
-    void Set(int index, TComponent object)
+    // Constructs the component of the entity in place, forwarding the arguments to its constructor.
+    // Growing the paged storage doesn't relocate the stored components. They still move when a component
+    // is removed (the last one fills its slot), when the pool is sorted, and when group entities join or leave
+    template <typename... TArgs>
+    TComponent &Emplace(int entityId, TArgs &&...args)
     {
-        data[index] = object;
+        if (Has(entityId))
+        {
+            // If the element already exists, simply replace the component object
+            TComponent &component = *GetAddress(GetIndex(entityId));
+            component = TComponent(std::forward<TArgs>(args)...);
+            return component;
+        }
+
+        // When adding a new object, we keep track of the entity id and its dense index
+        AllocatePages(size + 1);
+        TComponent *component = new (GetAddress(size)) TComponent(std::forward<TArgs>(args)...);
+        SetIndex(entityId, size);
+        indexToEntityId.push_back(entityId);
+        versions.push_back(0);
+        size++;
+        return *component;
     }
 
-    TComponent &Get(int index)
+    void Remove(int entityId)
     {
-        return static_cast<TComponent &>(data[index]);
+        if (!Has(entityId))
+        {
+            return;
+        }
+
+        // Move the last element to the deleted position to keep the array packed
+        const int indexOfRemoved = GetIndex(entityId);
+        const int indexOfLast = size - 1;
+        const int entityIdOfLast = indexToEntityId[indexOfLast];
+        if (indexOfRemoved != indexOfLast)
+        {
+            *GetAddress(indexOfRemoved) = std::move(*GetAddress(indexOfLast));
+        }
+        GetAddress(indexOfLast)->~TComponent();
+        indexToEntityId[indexOfRemoved] = entityIdOfLast;
+        versions[indexOfRemoved] = versions[indexOfLast];
+        SetIndex(entityIdOfLast, indexOfRemoved);
+
+        size--;
+        indexToEntityId.pop_back();
+        versions.pop_back();
+        SetIndex(entityId, -1);
     }
 
-    TComponent &operator[](int index)
+    void RemoveEntityFromPool(int entityId) override
     {
-        return data[index];
+        Remove(entityId);
     }
 
-    const TComponent &operator[](int index) const
+    std::shared_ptr<IPool> CreateEmpty() const override
     {
-        return data[index];
+        return std::make_shared<Pool<TComponent>>();
     }
-};
-
-////////////////////////////////////////////////////////////////////////////////////////
-// REGISTRY
-////////////////////////////////////////////////////////////////////////////////////////
-// The registry manages the creation and destruction of entities,
-// add systems, and components
-////////////////////////////////////////////////////////////////////////////////////////
 
-class Registry
-{
-private:
-    int nextEntityId = 0;
-    std::set<Entity> entitiesToBeAdded;  // Entities awaiting creation in the next Registry.Update()
-    std::set<Entity> entitiesToBeKilled; // Entities awaiting destruction in the next Registry.Update()
-    std::deque<int> freeIDs;             // List of free entity IDs that were previously removed
-    // Vector of component pools, each pool contains all the data for a certain component type
-    // [Vector index = component type id]
-    // [Pool index = entity id]
-    std::vector<std::shared_ptr<IPool>> componentPools;
-    // Vector of component signatures.
-    // The signature lets us know which components are turned on for an entity
-    // [Vector index = entity id]
-    std::vector<Signature> entityComponentSignatures;
-    std::unordered_map<std::type_index, std::shared_ptr<System>> systems;
+    void MoveComponentsTo(IPool &target, const std::vector<int> &entityIdMap, std::uint32_t version) override
+    {
+        auto &targetPool = static_cast<Pool<TComponent> &>(target);
+        targetPool.Reserve(targetPool.GetSize() + size);
+        for (int i = 0; i < size; i++)
+        {
+            const int targetEntityId = entityIdMap[indexToEntityId[i]];
+            targetPool.Emplace(targetEntityId, std::move(*GetAddress(i)));
+            targetPool.SetVersion(targetEntityId, version);
+        }
+        Clear();
+    }
 
-public:
-    Registry() { Logger::Log("Registry constructor called"); };
-    ~Registry() { Logger::Log("Registry destructor called"); };
+    PoolStats GetStats() const override
+    {
+        int numSparsePages = 0;
+        for (const auto &sparsePage : sparsePages)
+        {
+            numSparsePages += sparsePage ? 1 : 0;
+        }
 
-    // Entity management
-    Entity CreateEntity();
-    void KillEntity(Entity Entity);
-    void AddEntityToSystems(Entity entity);
-    void RemoveEntityFromSystems(Entity entity);
+        PoolStats stats;
+        stats.componentName = typeid(TComponent).name();
+        stats.componentSize = sizeof(TComponent);
+        stats.size = size;
+        stats.capacity = pages.size() * COMPONENTS_PER_PAGE;
+        stats.unusedComponentSlots = stats.capacity - size;
+        stats.unusedSparseSlots = numSparsePages * POOL_SPARSE_PAGE_SIZE - size;
+        stats.bytes = pages.size() * COMPONENTS_PER_PAGE * sizeof(TComponent) +
+                      indexToEntityId.capacity() * sizeof(int) + versions.capacity() * sizeof(std::uint32_t) +
+                      sparsePages.capacity() * sizeof(std::unique_ptr<int[]>) + numSparsePages * POOL_SPARSE_PAGE_SIZE * sizeof(int);
+        return stats;
+    }
 
-    // Component management
-    template <typename TComponent, typename... TArgs>
-    void AddComponent(Entity entity, TArgs &&...args);
-    template <typename TComponent>
-    void RemoveComponent(Entity entity);
-    template <typename TComponent>
-    bool HasComponent(Entity entity) const;
-    template <typename TComponent>
-    TComponent &GetComponent(Entity entity) const;
+    // Swaps two components in the dense array, together with their entity ids and versions
+    void Swap(int indexA, int indexB)
+    {
+        if (indexA == indexB)
+        {
+            return;
+        }
+        std::swap(*GetAddress(indexA), *GetAddress(indexB));
+        std::swap(indexToEntityId[indexA], indexToEntityId[indexB]);
+        std::swap(versions[indexA], versions[indexB]);
+        SetIndex(indexToEntityId[indexA], indexA);
+        SetIndex(indexToEntityId[indexB], indexB);
+    }
 
-    // System management
-    template <typename TSystem, typename... TArgs>
-    void AddSystem(TArgs &&...args);
-    template <typename TSystem>
-    void RemoveSystem();
-    template <typename TSystem>
-    bool HasSystem() const;
-    template <typename TSystem>
-    TSystem &GetSystem() const;
+    // Dense index of the component of the entity (-1 = none)
+    int GetIndexOf(int entityId) const
+    {
+        return Has(entityId) ? GetIndex(entityId) : -1;
+    }
 
-    void Update();
-};
+    TComponent &Get(int entityId)
+    {
+        return *GetAddress(GetIndex(entityId));
+    }
 
-template <typename TComponent, typename... TArgs>
-void Registry::AddComponent(Entity entity, TArgs &&...args)
-{
-    const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    void SetVersion(int entityId, std::uint32_t version)
+    {
+        versions[GetIndex(entityId)] = version;
+    }
 
-    // If the component id is greater than the current size of the componentPools, then resize the vector
-    if (componentId >= static_cast<int>(componentPools.size()))
+    std::uint32_t GetVersion(int entityId) const
     {
-        componentPools.resize(componentId + 1, nullptr);
+        return versions[GetIndex(entityId)];
     }
 
-    // If we still don't have a pool for that component type
-    if (!componentPools[componentId])
+    // Version of the component stored at the given dense index
+    std::uint32_t GetVersionAt(int index) const
     {
-        componentPools[componentId] = std::make_shared<Pool<TComponent>>(10);
+        return versions[index];
     }
 
-    // Get the pool of component values for that component type
-    std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
+    void SetVersionAt(int index, std::uint32_t version)
+    {
+        versions[index] = version;
+    }
 
-    // if the entity id is greater than the current size of the component pool, then resize the pool
-    if (entityId >= componentPool->GetSize())
+    // Entity id owning the component stored at the given dense index
+    int GetEntityIdAt(int index) const
     {
-        componentPool->Resize(entityId + 1);
+        return indexToEntityId[index];
     }
 
-    // Create a new Component object of the type TComponent, and forward the various parameters to the constructor
-    TComponent component(std::forward<TArgs>(args)...);
+    // Ids of all the entities that have this component, in dense order
+    const std::vector<int> &GetEntityIds() const
+    {
+        return indexToEntityId;
+    }
 
-    // Add the new component to the component pool list, using the entity id as index
-    componentPool->Set(entityId, component);
+    // Dense access, used to iterate only the live components
+    TComponent &operator[](int index)
+    {
+        return *GetAddress(index);
+    }
 
-    // Finally change the component signature of the entity and set the component id on the bitset to 1
-    entityComponentSignatures[entityId].set(componentId);
+    const TComponent &operator[](int index) const
+    {
+        return *GetAddress(index);
+    }
+};
 
-    Logger::Log("Component id = ", componentId, " was added to entity id = ", entityId);
-}
+////////////////////////////////////////////////////////////////////////////////////////
+// ARCHETYPE
+////////////////////////////////////////////////////////////////////////////////////////
+// Optional storage mode of the registry. All the entities with the same signature
+// share an archetype, which keeps them in fixed-size chunks. Inside a chunk every
+// component type has its own column, so a query is just a linear sweep over the
+// chunks of the archetypes that match the query signature.
+////////////////////////////////////////////////////////////////////////////////////////
 
-template <typename TComponent>
-void Registry::RemoveComponent(Entity entity)
+enum class StorageMode
+{
+    Pools,
+    Archetypes
+};
+
+// Size in bytes of an archetype chunk (a single row that doesn't fit gets a bigger chunk)
+const std::size_t ARCHETYPE_CHUNK_SIZE = 16 * 1024;
+
+// Type-erased information used to move and destroy the components inside a chunk column.
+// Trivially copyable components are relocated with memcpy and never destroyed
+struct ComponentTypeInfo
+{
+    std::size_t size = 0;
+    std::size_t alignment = 1;
+    bool isTriviallyCopyable = false;
+    void (*moveConstruct)(void *destination, void *source) = nullptr;
+    void (*destroy)(void *object) = nullptr;
+};
+
+template <typename TComponent>
+ComponentTypeInfo MakeComponentTypeInfo()
+{
+    ComponentTypeInfo typeInfo;
+    typeInfo.size = sizeof(TComponent);
+    typeInfo.alignment = alignof(TComponent);
+    typeInfo.isTriviallyCopyable = std::is_trivially_copyable<TComponent>::value;
+    typeInfo.moveConstruct = [](void *destination, void *source)
+    { new (destination) TComponent(std::move(*static_cast<TComponent *>(source))); };
+    typeInfo.destroy = [](void *object)
+    { static_cast<TComponent *>(object)->~TComponent(); };
+    return typeInfo;
+}
+
+struct ArchetypeRow
+{
+    int chunkIndex = 0;
+    int row = 0;
+};
+
+class Archetype
+{
+private:
+    struct Column
+    {
+        int componentId;
+        std::size_t offset;
+        ComponentTypeInfo typeInfo;
+    };
+
+    Signature signature;
+    int chunkCapacity;
+    std::size_t chunkBytes;
+    std::vector<Column> columns;
+    // Lookup of the column that holds a certain component type (-1 = not in the archetype)
+    // [Vector index = component type id]
+    std::vector<int> componentColumns;
+    // Every chunk is full except the last one, so the last row is always at the end of the last chunk
+    std::vector<std::unique_ptr<std::max_align_t[]>> chunks;
+    std::vector<int> chunkSizes;
+
+    std::byte *GetChunkData(int chunkIndex) const
+    {
+        return reinterpret_cast<std::byte *>(chunks[chunkIndex].get());
+    }
+
+    void *GetAddress(const Column &column, ArchetypeRow row) const
+    {
+        return GetChunkData(row.chunkIndex) + column.offset + column.typeInfo.size * row.row;
+    }
+
+    // Moves a component to uninitialized memory, leaving the source destroyed
+    static void Relocate(const ComponentTypeInfo &typeInfo, void *destination, void *source);
+
+public:
+    Archetype(const Signature &signature, const std::vector<ComponentTypeInfo> &componentTypeInfos);
+    ~Archetype();
+
+    const Signature &GetSignature() const;
+    int GetNumChunks() const;
+    std::size_t GetChunkBytes() const;
+    int GetChunkSize(int chunkIndex) const;
+
+    // Entity ids are stored at the start of every chunk
+    int *GetEntityIds(int chunkIndex) const
+    {
+        return reinterpret_cast<int *>(GetChunkData(chunkIndex));
+    }
+
+    template <typename TComponent>
+    TComponent *GetColumn(int chunkIndex) const
+    {
+        const auto &column = columns[componentColumns[Component<TComponent>::GetId()]];
+        return reinterpret_cast<TComponent *>(GetChunkData(chunkIndex) + column.offset);
+    }
+
+    void *GetComponent(int componentId, ArchetypeRow row) const
+    {
+        return GetAddress(columns[componentColumns[componentId]], row);
+    }
+
+    // Appends an uninitialized row for the entity at the end of the archetype
+    ArchetypeRow AllocateRow(int entityId);
+    // Move constructs the components both archetypes have from the source row into the given row
+    void MoveComponentsFrom(Archetype &source, ArchetypeRow sourceRow, ArchetypeRow row);
+    // Destroys the row and moves the last row into its place, returns the id of the moved entity (or -1)
+    int RemoveRow(ArchetypeRow row);
+};
+
+class ArchetypeStorage
+{
+private:
+    struct EntityLocation
+    {
+        Archetype *archetype = nullptr;
+        ArchetypeRow row;
+    };
+
+    // [Vector index = component type id]
+    std::vector<ComponentTypeInfo> componentTypeInfos;
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<Signature, Archetype *> archetypesBySignature;
+    // [Vector index = entity id]
+    std::vector<EntityLocation> entityLocations;
+    // Registry version in which each component was added or last changed
+    // [Vector index = component type id][Vector index = entity id]
+    std::vector<std::vector<std::uint32_t>> componentVersions;
+
+    Archetype *GetOrCreateArchetype(const Signature &signature);
+    // Moves the entity into the archetype of the new signature, new components are left uninitialized
+    void MoveEntity(int entityId, const Signature &signature);
+
+public:
+    ArchetypeStorage() = default;
+
+    template <typename TComponent, typename... TArgs>
+    void AddComponent(int entityId, TArgs &&...args);
+    void RemoveComponent(int entityId, int componentId);
+    void RemoveEntity(int entityId);
+    template <typename TComponent>
+    TComponent &GetComponent(int entityId) const;
+    void SetVersion(int componentId, int entityId, std::uint32_t version);
+    std::uint32_t GetVersion(int componentId, int entityId) const;
+    const std::vector<std::unique_ptr<Archetype>> &GetArchetypes() const;
+
+    // Calls func(entityId, TComponents &...) chunk by chunk for all the archetypes that match
+    template <typename... TComponents, typename TFunc>
+    void Each(TFunc func) const;
+    // Same as Each, but the chunks are processed in parallel
+    template <typename... TComponents, typename TFunc>
+    void ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const;
+
+private:
+    template <typename... TComponents, typename TFunc>
+    static void EachInChunk(const Archetype &archetype, int chunkIndex, TFunc &func);
+    template <typename... TComponents>
+    static Signature GetQuerySignature();
+};
+
+template <typename TComponent, typename... TArgs>
+void ArchetypeStorage::AddComponent(int entityId, TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    if (componentId >= static_cast<int>(componentTypeInfos.size()))
+    {
+        componentTypeInfos.resize(componentId + 1);
+    }
+    if (!componentTypeInfos[componentId].moveConstruct)
+    {
+        componentTypeInfos[componentId] = MakeComponentTypeInfo<TComponent>();
+    }
+    if (entityId >= static_cast<int>(entityLocations.size()))
+    {
+        entityLocations.resize(entityId + 1);
+    }
+
+    const auto &location = entityLocations[entityId];
+    Signature signature;
+    if (location.archetype)
+    {
+        signature = location.archetype->GetSignature();
+    }
+
+    if (signature.test(componentId))
+    {
+        // The entity already has this component, simply replace the component object
+        GetComponent<TComponent>(entityId) = TComponent(std::forward<TArgs>(args)...);
+        return;
+    }
+
+    signature.set(componentId);
+    MoveEntity(entityId, signature);
+
+    const auto &newLocation = entityLocations[entityId];
+    new (newLocation.archetype->GetComponent(componentId, newLocation.row)) TComponent(std::forward<TArgs>(args)...);
+}
+
+template <typename TComponent>
+TComponent &ArchetypeStorage::GetComponent(int entityId) const
+{
+    const auto &location = entityLocations[entityId];
+    return *static_cast<TComponent *>(location.archetype->GetComponent(Component<TComponent>::GetId(), location.row));
+}
+
+template <typename... TComponents>
+Signature ArchetypeStorage::GetQuerySignature()
+{
+    return MakeSignature<TComponents...>();
+}
+
+template <typename... TComponents, typename TFunc>
+void ArchetypeStorage::EachInChunk(const Archetype &archetype, int chunkIndex, TFunc &func)
+{
+    const int *entityIds = archetype.GetEntityIds(chunkIndex);
+    const auto columns = std::make_tuple(archetype.template GetColumn<TComponents>(chunkIndex)...);
+    const int size = archetype.GetChunkSize(chunkIndex);
+    for (int row = 0; row < size; row++)
+    {
+        func(entityIds[row], std::get<TComponents *>(columns)[row]...);
+    }
+}
+
+template <typename... TComponents, typename TFunc>
+void ArchetypeStorage::Each(TFunc func) const
+{
+    const Signature querySignature = GetQuerySignature<TComponents...>();
+    for (const auto &archetype : archetypes)
+    {
+        if ((archetype->GetSignature() & querySignature) != querySignature)
+        {
+            continue;
+        }
+        for (int chunkIndex = 0; chunkIndex < archetype->GetNumChunks(); chunkIndex++)
+        {
+            EachInChunk<TComponents...>(*archetype, chunkIndex, func);
+        }
+    }
+}
+
+template <typename... TComponents, typename TFunc>
+void ArchetypeStorage::ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const
+{
+    // Every chunk of a matching archetype is a task
+    const Signature querySignature = GetQuerySignature<TComponents...>();
+    std::vector<std::pair<const Archetype *, int>> chunks;
+    int numEntities = 0;
+    for (const auto &archetype : archetypes)
+    {
+        if ((archetype->GetSignature() & querySignature) != querySignature)
+        {
+            continue;
+        }
+        for (int chunkIndex = 0; chunkIndex < archetype->GetNumChunks(); chunkIndex++)
+        {
+            chunks.push_back({archetype.get(), chunkIndex});
+            numEntities += archetype->GetChunkSize(chunkIndex);
+        }
+    }
+
+    if (numEntities < PARALLEL_EACH_MIN_ENTITIES)
+    {
+        for (const auto &chunk : chunks)
+        {
+            EachInChunk<TComponents...>(*chunk.first, chunk.second, func);
+        }
+        return;
+    }
+
+    threadPool->ParallelFor(chunks.size(), 1, [&chunks, &func](int begin, int end)
+                            {
+        for (int i = begin; i < end; i++)
+        {
+            EachInChunk<TComponents...>(*chunks[i].first, chunks[i].second, func);
+        } });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// VIEW
+////////////////////////////////////////////////////////////////////////////////////////
+// A view iterates all the entities that have every one of the TComponents.
+// The pool pointers are resolved once when the view is created, so the loop
+// hands back component references without going through the registry.
+// In archetype storage mode the view sweeps the chunks of the matching archetypes instead.
+// Example: registry->View<TransformComponent, RigidBodyComponent>().each([](auto &t, auto &rb) {...})
+////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename... TComponents>
+class ComponentView
+{
+private:
+    class Registry *registry;
+    const ArchetypeStorage *archetypeStorage;
+    std::tuple<Pool<TComponents> *...> pools;
+
+public:
+    ComponentView(class Registry *registry, const ArchetypeStorage *archetypeStorage, Pool<TComponents> *...pools)
+        : registry(registry), archetypeStorage(archetypeStorage), pools(pools...) {}
+
+    // Calls func(TComponents &...) or func(Entity, TComponents &...) for every matching entity.
+    // Components of the viewed types must not be added or removed inside func.
+    template <typename TFunc>
+    void each(TFunc func) const;
+    // Same as each, but the entities are split in chunks that run in parallel on the thread pool
+    template <typename TFunc>
+    void ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const;
+
+private:
+    // Ids of the entities of the smallest pool, or nullptr if one of the component types was never added
+    const std::vector<int> *GetSmallestPoolEntityIds() const;
+    template <typename TFunc>
+    void Invoke(TFunc &func, int entityId) const;
+    template <typename TFunc>
+    auto WithEntityId(TFunc &func) const;
+};
+
+// Iterates the TComponent components that were added or changed (through GetMutableComponent
+// or MarkChanged) in sinceVersion or later. A system remembers registry->GetVersion() after it
+// runs, and asks for the changes since then on its next run.
+// Example: registry->Changed<TransformComponent>(lastVersion).each([](Entity entity, auto &transform) {...})
+template <typename TComponent>
+class ChangedView
+{
+private:
+    class Registry *registry;
+    const ArchetypeStorage *archetypeStorage;
+    Pool<TComponent> *pool;
+    std::uint32_t sinceVersion;
+
+public:
+    ChangedView(class Registry *registry, const ArchetypeStorage *archetypeStorage, Pool<TComponent> *pool, std::uint32_t sinceVersion)
+        : registry(registry), archetypeStorage(archetypeStorage), pool(pool), sinceVersion(sinceVersion) {}
+
+    // Calls func(Entity, TComponent &) for every changed component
+    template <typename TFunc>
+    void each(TFunc func) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// GROUP
+////////////////////////////////////////////////////////////////////////////////////////
+// A group is a view over components that are always iterated together, which takes
+// ownership of their pools: the entities that have all the TComponents are kept packed
+// at the front of every owned pool, in the same order. Iterating the group walks the
+// owned pools in lockstep as plain arrays, without looking up any entity.
+// A pool is owned by a single group. The components whose pool already belongs to another
+// group are looked up through their sparse array instead.
+// Example: registry->GetGroup<TransformComponent, RigidBodyComponent>().each([](auto &t, auto &rb) {...})
+////////////////////////////////////////////////////////////////////////////////////////
+
+class IGroup
+{
+public:
+    virtual ~IGroup() {}
+    // Called after a component of the group was added to the entity
+    virtual void OnComponentAdded(int entityId, const Signature &entityComponentSignature) = 0;
+    // Called before a component of the group is removed from the entity
+    virtual void OnComponentRemoved(int entityId) = 0;
+    virtual int GetSize() const = 0;
+    // Swaps two entities of the group in every owned pool
+    virtual void SwapEntities(int indexA, int indexB) = 0;
+};
+
+template <typename... TComponents>
+class Group : public IGroup
+{
+private:
+    class Registry *registry;
+    std::tuple<Pool<TComponents> *...> pools;
+    // Same pools, but only the ones the group owns (nullptr = looked up by entity id)
+    std::tuple<Pool<TComponents> *...> ownedPools;
+    // Components that the group entities have, and the ones whose pools the group keeps sorted
+    Signature signature;
+    Signature ownedSignature;
+    // The group entities are the first size entities of every owned pool
+    int size = 0;
+
+    template <typename TComponent>
+    bool IsOwned() const;
+    template <typename TComponent>
+    TComponent &GetComponentAt(int index, int entityId) const;
+    // Dense index of the entity in the owned pools (-1 = not in the pools)
+    int GetIndexOf(int entityId) const;
+    int GetEntityIdAt(int index) const;
+    // Moves the component of the entity to the given index of every owned pool
+    void MoveToIndex(int entityId, int index);
+    template <typename TFunc>
+    auto Invoke(TFunc &func, int index) const;
+
+public:
+    Group(class Registry *registry, const Signature &ownedSignature, Pool<TComponents> *...pools);
+
+    int GetSize() const override;
+    void SwapEntities(int indexA, int indexB) override;
+    // False if the group owns no pool (e.g. in archetype storage mode), then it iterates like a view
+    bool IsOwning() const;
+    // Calls func(TComponents &...) or func(Entity, TComponents &...) for every entity of the group.
+    // Components of the group types must not be added or removed inside func.
+    template <typename TFunc>
+    void each(TFunc func) const;
+    // Same as each, but the entities are split in chunks that run in parallel on the thread pool
+    template <typename TFunc>
+    void ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const;
+    // Same as ParallelEach, but func returns true when it changed the TChanged component, which is then
+    // flagged like Registry.MarkChanged. In an owned pool the version is set by dense index, without a lookup
+    template <typename TChanged, typename TFunc>
+    void ParallelEachMarkChanged(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const;
+
+    void OnComponentAdded(int entityId, const Signature &entityComponentSignature) override;
+    void OnComponentRemoved(int entityId) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// SHARED COMPONENT
+////////////////////////////////////////////////////////////////////////////////////////
+// A shared (flyweight) component is a single instance referenced by many entities.
+// The entities store a small Shared<TComponent> handle as a regular component, and
+// copying the handle shares the instance instead of copying it. The instance is read-only
+// while it is shared, Write() gives the entity its own copy first (copy-on-write).
+// Example: auto sprite = Shared<SpriteComponent>::Create("tank-image", 32, 32, 1);
+//          entity.AddComponent<Shared<SpriteComponent>>(sprite);
+////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename TComponent>
+class Shared
+{
+private:
+    struct Instance
+    {
+        TComponent component;
+        std::atomic<int> useCount;
+
+        template <typename... TArgs>
+        Instance(TArgs &&...args) : component(std::forward<TArgs>(args)...), useCount(1) {}
+    };
+
+    Instance *instance = nullptr;
+
+    explicit Shared(Instance *instance) : instance(instance) {}
+    void Release();
+
+public:
+    Shared() = default;
+    Shared(const Shared &other);
+    Shared(Shared &&other) noexcept;
+    Shared &operator=(Shared other) noexcept;
+    ~Shared();
+
+    template <typename... TArgs>
+    static Shared Create(TArgs &&...args);
+
+    bool IsValid() const;
+    // Number of handles referencing the instance
+    int GetUseCount() const;
+    const TComponent &Get() const;
+    const TComponent *operator->() const;
+    // Makes the instance unique to this handle (copying it if it's shared) and returns it.
+    // Two threads must not write through the same handle at the same time
+    TComponent &Write();
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// PREFAB
+////////////////////////////////////////////////////////////////////////////////////////
+// A prefab is a named entity template, registered once in the registry. It holds
+// pre-built components that are copied into every instance. A Shared<TComponent>
+// handle added to the prefab makes all the instances reference the same component.
+// Example: registry->Instantiate(registry->GetPrefab("tank"), TransformComponent(...))
+////////////////////////////////////////////////////////////////////////////////////////
+
+class Prefab
+{
+private:
+    struct PrefabComponent
+    {
+        int componentId;
+        std::shared_ptr<void> component;
+        void (*copyTo)(class Registry &registry, Entity entity, const void *component);
+    };
+
+    std::string name;
+    // Components copied into every instance
+    std::vector<PrefabComponent> components;
+
+public:
+    Prefab(const std::string &name) : name(name) {}
+
+    const std::string &GetName() const;
+    // Adds (or replaces) a component that is copied into every instance
+    template <typename TComponent, typename... TArgs>
+    Prefab &AddComponent(TArgs &&...args);
+    // Copies the components into the entity, except the types in skipSignature
+    void CopyTo(class Registry &registry, Entity entity, const Signature &skipSignature) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// COMMAND BUFFER
+////////////////////////////////////////////////////////////////////////////////////////
+// A command buffer records structural changes (create/kill entities, add/remove
+// components) so systems can request them from any thread. Every thread gets its own
+// buffer from registry->GetCommandBuffer(), and Registry.Update() plays all of them back.
+// The commands are played back sorted by their sort key (then by buffer and record order),
+// so setting the key to the entity being processed keeps the order deterministic even
+// when the entities are split between the worker threads.
+// The buffers keep their memory between frames, so recording doesn't allocate once warm.
+////////////////////////////////////////////////////////////////////////////////////////
+
+class CommandBuffer
+{
+private:
+    enum class CommandType
+    {
+        CreateEntity,
+        KillEntity,
+        AddComponent,
+        RemoveComponent,
+        InstantiatePrefab
+    };
+
+    struct Command
+    {
+        CommandType type;
+        std::uint64_t sortKey;
+        // Entities created by this buffer have a placeholder id [-1 - index of the created entity]
+        Entity entity;
+        // Component object moved into the registry (AddComponent), or the prefab to copy (InstantiatePrefab)
+        void *payload;
+        void (*apply)(class Registry &registry, Entity entity, void *payload);
+        void (*destroyPayload)(void *payload);
+    };
+
+    std::vector<Command> commands;
+    LinearArena payloads;
+    std::uint64_t sortKey = 0;
+    int numCreatedEntities = 0;
+    // Real entities of the placeholders, filled during the playback
+    std::vector<Entity> createdEntities;
+    // Thread the buffer belongs to
+    std::thread::id threadId;
+
+    struct PrefabPayload
+    {
+        const Prefab *prefab;
+        // Component types passed as overrides, which are not copied from the prefab
+        Signature skipSignature;
+    };
+
+    Entity ResolveEntity(class Registry &registry, Entity entity);
+
+    friend class Registry;
+
+public:
+    CommandBuffer() = default;
+    CommandBuffer(const CommandBuffer &) = delete;
+    ~CommandBuffer();
+
+    // Key of the commands recorded from now on
+    void SetSortKey(std::uint64_t sortKey);
+
+    // Returns a placeholder entity, only valid for the commands of this buffer until the playback
+    Entity CreateEntity();
+    void KillEntity(Entity entity);
+    template <typename TComponent, typename... TArgs>
+    void AddComponent(Entity entity, TArgs &&...args);
+    template <typename TComponent>
+    void RemoveComponent(Entity entity);
+    // Returns a placeholder entity that gets the prefab components, the overrides replace the prefab ones
+    template <typename... TOverrides>
+    Entity Instantiate(const Prefab &prefab, TOverrides &&...overrides);
+
+    int GetNumCommands() const;
+    // Applies the command to the registry, placeholder entities are created on first use
+    void Apply(class Registry &registry, int commandIndex);
+    // Destroys the recorded payloads and forgets all the commands
+    void Clear();
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// REGISTRY
+////////////////////////////////////////////////////////////////////////////////////////
+// The registry manages the creation and destruction of entities,
+// add systems, and components
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Number of entities in a system, see Registry.GetStats()
+struct SystemStats
+{
+    std::string systemName;
+    int numEntities = 0;
+};
+
+// Snapshot of the registry counters, used for capacity planning and to spot memory blowups
+struct RegistryStats
+{
+    int numEntities = 0;
+    int numFreeIds = 0;
+    // Entity churn of the last frame (between the last two Registry.Update())
+    int numEntitiesCreated = 0;
+    int numEntitiesKilled = 0;
+    // Per-entity arrays of the registry (signatures, generations and flags)
+    std::size_t entityBytes = 0;
+    std::vector<PoolStats> pools;
+    std::size_t poolBytes = 0;
+    // Only used in archetype storage mode
+    int numArchetypes = 0;
+    int numChunks = 0;
+    std::size_t archetypeBytes = 0;
+    std::vector<SystemStats> systems;
+};
+
+class Registry
+{
+private:
+    int nextEntityId = 0;
+    std::vector<Entity> entitiesToBeAdded;  // Entities awaiting creation in the next Registry.Update()
+    std::vector<Entity> entitiesToBeKilled; // Entities awaiting destruction in the next Registry.Update()
+    std::deque<int> freeIDs;             // List of free entity IDs that were previously removed
+    // Vector of entity generations, incremented every time an entity id is recycled
+    // [Vector index = entity id]
+    std::vector<std::uint32_t> entityGenerations;
+    // Vector of component pools, each pool contains all the data for a certain component type
+    // [Vector index = component type id]
+    // [Pool lookup = entity id]
+    std::vector<std::shared_ptr<IPool>> componentPools;
+    // Vector of component signatures.
+    // The signature lets us know which components are turned on for an entity
+    // [Vector index = entity id]
+    std::vector<Signature> entityComponentSignatures;
+    // Flags the entities that were already added to the systems by Registry.Update()
+    // [Vector index = entity id]
+    std::vector<bool> entityIsActive;
+    // Flags the entities already in entitiesToBeKilled, so they are only killed once
+    // [Vector index = entity id]
+    std::vector<bool> entityIsBeingKilled;
+    // Incremented by every Registry.Update(), the components changed during a frame are stamped with it
+    std::uint32_t version = 1;
+    // Entities created and killed during the current frame, and during the last one
+    int numEntitiesCreated = 0;
+    int numEntitiesKilled = 0;
+    int lastFrameEntitiesCreated = 0;
+    int lastFrameEntitiesKilled = 0;
+    // Chunked component storage, only used when the registry is in archetype storage mode
+    std::unique_ptr<ArchetypeStorage> archetypeStorage;
+    std::unordered_map<std::type_index, std::shared_ptr<System>> systems;
+    // Vector of the systems that require a certain component type
+    // [Vector index = component type id]
+    std::vector<std::vector<System *>> componentSystems;
+
+    // Systems that run every frame, in their declared (fallback) order.
+    // A system depends on all the earlier systems it conflicts with, which forms a DAG
+    struct ScheduledSystem
+    {
+        System *system;
+        std::function<void()> update;
+        std::vector<int> dependents;
+        int numDependencies = 0;
+    };
+    std::vector<ScheduledSystem> schedule;
+
+    // Unique id of the registry, used by the threads to find their command buffer
+    const int registryId;
+    static std::atomic<int> nextRegistryId;
+    // One command buffer for each thread that recorded commands
+    std::vector<std::unique_ptr<CommandBuffer>> commandBuffers;
+    std::mutex commandBuffersMutex;
+    struct SortedCommand
+    {
+        std::uint64_t sortKey;
+        int bufferIndex;
+        int commandIndex;
+    };
+    std::vector<SortedCommand> sortedCommands;
+
+    std::unordered_map<std::string, std::unique_ptr<Prefab>> prefabs;
+
+    // Registries populated on other threads, merged into this one by the next Registry.Update()
+    std::vector<std::unique_ptr<Registry>> stagingRegistries;
+    std::mutex stagingRegistriesMutex;
+
+    std::unordered_map<std::type_index, std::unique_ptr<IGroup>> groups;
+    // Vector of the groups that include a certain component type
+    // [Vector index = component type id]
+    std::vector<std::vector<IGroup *>> componentGroups;
+    // Group that owns (keeps sorted) the pool of a certain component type, nullptr = none
+    // [Vector index = component type id]
+    std::vector<IGroup *> componentOwningGroups;
+    // Progress of the incremental sort of a component pool, see Registry.SortComponents()
+    // [Vector index = component type id]
+    struct ComponentSort
+    {
+        // Entity ids in the order the pool is being sorted to, and the next one to place
+        std::vector<int> entityIds;
+        std::size_t next = 0;
+        int position = 0;
+    };
+    std::vector<ComponentSort> componentSorts;
+
+    void PlaybackCommandBuffers();
+    void MergeStagingRegistries();
+    void MergeRegistry(Registry &stagingRegistry);
+
+    void AddSystemToComponentSystems(System *system);
+    void RemoveSystemFromComponentSystems(System *system);
+    // Drops the scheduled updates of the system, and rebuilds the dependencies of the others
+    void RemoveSystemFromSchedule(System *system);
+    void OnComponentAdded(Entity entity, int componentId);
+    void OnComponentRemoved(Entity entity, int componentId);
+    // Lets the groups of the component release the entity, before the component is removed
+    void RemoveEntityFromGroups(int entityId, int componentId);
+    void UpdateEntityInSystems(Entity entity, const std::vector<System *> &systemsToUpdate);
+    template <typename TComponent>
+    Pool<TComponent> *GetOrCreateComponentPool();
+    template <typename TComponent, typename TGetComponent>
+    void AddComponentsWith(const std::vector<Entity> &entities, TGetComponent getComponent);
+
+public:
+    Registry(StorageMode storageMode = StorageMode::Pools) : registryId(nextRegistryId++)
+    {
+        if (storageMode == StorageMode::Archetypes)
+        {
+            archetypeStorage = std::make_unique<ArchetypeStorage>();
+        }
+        Logger::Log("Registry constructor called");
+    };
+    ~Registry() { Logger::Log("Registry destructor called"); };
+
+    // Entity management
+    Entity CreateEntity();
+    // Creates count entities at once, optionally giving each of them a copy of the prototype components
+    std::vector<Entity> CreateEntities(int count);
+    template <typename... TComponents>
+    std::vector<Entity> CreateEntities(int count, const TComponents &...prototypes);
+    void KillEntity(Entity Entity);
+    bool IsAlive(Entity entity) const;
+    // True between KillEntity and the Registry.Update() that destroys the entity
+    bool IsBeingKilled(Entity entity) const;
+    Entity GetEntity(EntityHandle handle);
+    Entity GetEntityById(int entityId);
+    void AddEntityToSystems(Entity entity);
+    void RemoveEntityFromSystems(Entity entity);
+
+    // Component management
+    template <typename TComponent, typename... TArgs>
+    void AddComponent(Entity entity, TArgs &&...args);
+    // Batch versions of AddComponent, entities[i] gets components[i] (or a copy of component)
+    template <typename TComponent>
+    void AddComponents(const std::vector<Entity> &entities, std::vector<TComponent> components);
+    template <typename TComponent>
+    void AddComponents(const std::vector<Entity> &entities, const TComponent &component);
+    template <typename TComponent>
+    void RemoveComponent(Entity entity);
+    template <typename TComponent>
+    bool HasComponent(Entity entity) const;
+    template <typename TComponent>
+    TComponent &GetComponent(Entity entity) const;
+    template <typename TComponent>
+    Pool<TComponent> *GetComponentPool() const;
+    template <typename... TComponents>
+    ComponentView<TComponents...> View();
+    // Creates the group the first time it is requested. Create the groups while setting up,
+    // before the systems that use them can run in parallel
+    template <typename... TComponents>
+    Group<TComponents...> &GetGroup();
+    // Reorders the storage of TComponent so its entities are sorted by key(Entity) (a std::uint64_t,
+    // lowest first), moving at most maxMoves components per call. A new pass is planned when the
+    // previous one is done, so calling it every frame spreads the sort over several frames.
+    // Entity ids don't change, only the position of their components in the pool.
+    // Returns true when the pass is complete
+    template <typename TComponent, typename TKey>
+    bool SortComponents(TKey key, int maxMoves);
+
+    // Change tracking
+    std::uint32_t GetVersion() const;
+    template <typename TComponent>
+    void MarkChanged(Entity entity);
+    template <typename TComponent>
+    TComponent &GetMutableComponent(Entity entity);
+    template <typename TComponent>
+    std::uint32_t GetComponentVersion(Entity entity) const;
+    template <typename TComponent>
+    ChangedView<TComponent> Changed(std::uint32_t sinceVersion);
+
+    // System management
+    template <typename TSystem, typename... TArgs>
+    void AddSystem(TArgs &&...args);
+    template <typename TSystem>
+    void RemoveSystem();
+    template <typename TSystem>
+    bool HasSystem() const;
+    template <typename TSystem>
+    TSystem &GetSystem() const;
+
+    // System scheduling
+    template <typename TSystem, typename TFunc>
+    void ScheduleSystem(TFunc update);
+    void RunScheduledSystems(std::unique_ptr<ThreadPool> &threadPool);
+
+    // Prefab management
+    Prefab &RegisterPrefab(const std::string &name);
+    const Prefab &GetPrefab(const std::string &name) const;
+    bool HasPrefab(const std::string &name) const;
+    // Creates an entity with a copy of the prefab components, the overrides replace the prefab ones
+    template <typename... TOverrides>
+    Entity Instantiate(const Prefab &prefab, TOverrides &&...overrides);
+
+    // Deferred structural changes, safe to record from any thread
+    CommandBuffer &GetCommandBuffer();
+
+    // Queues a registry (usually populated on a worker thread) to be merged into this one by the next
+    // Registry.Update(). Its entities get new ids here, and join the systems like newly created entities.
+    // Entities stored inside its components still refer to the staging registry. Both registries must use
+    // pool storage, merging archetype storage aborts. Safe to call from any thread
+    void Merge(std::unique_ptr<Registry> stagingRegistry);
+
+    // Introspection
+    RegistryStats GetStats() const;
+    void LogStats() const;
+
+    void Update();
+};
+
+// Defined here because they need the complete Registry
+template <typename TComponent, typename... TArgs>
+void Entity::AddComponent(TArgs &&...args)
+{
+    registry->template AddComponent<TComponent>(*this, std::forward<TArgs>(args)...);
+}
+template <typename TComponent>
+void Entity::RemoveComponent()
+{
+    registry->template RemoveComponent<TComponent>(*this);
+}
+template <typename TComponent>
+bool Entity::HasComponent() const
+{
+    return registry->template HasComponent<TComponent>(*this);
+}
+template <typename TComponent>
+TComponent &Entity::GetComponent() const
+{
+    return registry->template GetComponent<TComponent>(*this);
+}
+template <typename TComponent>
+TComponent &Entity::GetMutableComponent() const
+{
+    return registry->template GetMutableComponent<TComponent>(*this);
+}
+
+template <typename TComponent, typename... TArgs>
+void Registry::AddComponent(Entity entity, TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    const auto entityId = entity.GetId();
+
+    if constexpr (IsTagComponent<TComponent>::value)
+    {
+        // Tag components have no data, the bit in the entity signature is all we need to store
+    }
+    else if (archetypeStorage)
+    {
+        // Move the entity to the archetype of its new signature, and construct the component there
+        archetypeStorage->template AddComponent<TComponent>(entityId, std::forward<TArgs>(args)...);
+    }
+    else
+    {
+        // Construct the component directly in the pool, forwarding the various parameters to its constructor
+        GetOrCreateComponentPool<TComponent>()->Emplace(entityId, std::forward<TArgs>(args)...);
+    }
+
+    // Finally change the component signature of the entity and set the component id on the bitset to 1
+    entityComponentSignatures[entityId].set(componentId);
+    if constexpr (!IsTagComponent<TComponent>::value)
+    {
+        MarkChanged<TComponent>(entity);
+    }
+    OnComponentAdded(entity, componentId);
+
+    Logger::Log("Component id = ", componentId, " was added to entity id = ", entityId);
+}
+
+template <typename TComponent>
+void Registry::AddComponents(const std::vector<Entity> &entities, std::vector<TComponent> components)
+{
+    if (components.size() != entities.size())
+    {
+        Logger::Err("AddComponents got ", components.size(), " components for ", entities.size(), " entities");
+        return;
+    }
+    AddComponentsWith<TComponent>(entities, [&components](std::size_t i) -> TComponent &&
+                                  { return std::move(components[i]); });
+}
+
+template <typename TComponent>
+void Registry::AddComponents(const std::vector<Entity> &entities, const TComponent &component)
+{
+    AddComponentsWith<TComponent>(entities, [&component](std::size_t) -> const TComponent &
+                                  { return component; });
+}
+
+template <typename... TComponents>
+std::vector<Entity> Registry::CreateEntities(int count, const TComponents &...prototypes)
+{
+    std::vector<Entity> entities = CreateEntities(count);
+    (AddComponents<TComponents>(entities, prototypes), ...);
+    return entities;
+}
+
+// Shared by the AddComponents overloads, getComponent(i) returns the component of entities[i]
+template <typename TComponent, typename TGetComponent>
+void Registry::AddComponentsWith(const std::vector<Entity> &entities, TGetComponent getComponent)
+{
+    const auto componentId = Component<TComponent>::GetId();
+
+    if constexpr (IsTagComponent<TComponent>::value)
+    {
+        // Tag components have no data, the bit in the entity signature is all we need to store
+    }
+    else if (archetypeStorage)
+    {
+        for (std::size_t i = 0; i < entities.size(); i++)
+        {
+            archetypeStorage->template AddComponent<TComponent>(entities[i].GetId(), getComponent(i));
+        }
+    }
+    else
+    {
+        // Reserve once, so filling the pool never grows it one page at a time
+        auto componentPool = GetOrCreateComponentPool<TComponent>();
+        componentPool->Reserve(componentPool->GetSize() + entities.size());
+        for (std::size_t i = 0; i < entities.size(); i++)
+        {
+            componentPool->Emplace(entities[i].GetId(), getComponent(i));
+        }
+    }
+
+    for (auto entity : entities)
+    {
+        entityComponentSignatures[entity.GetId()].set(componentId);
+        if constexpr (!IsTagComponent<TComponent>::value)
+        {
+            MarkChanged<TComponent>(entity);
+        }
+        OnComponentAdded(entity, componentId);
+    }
+
+    Logger::Log("Component id = ", componentId, " was added to ", entities.size(), " entities");
+}
+
+template <typename TComponent>
+Pool<TComponent> *Registry::GetOrCreateComponentPool()
+{
+    const auto componentId = Component<TComponent>::GetId();
+
+    // If the component id is greater than the current size of the componentPools, then resize the vector
+    if (componentId >= static_cast<int>(componentPools.size()))
+    {
+        componentPools.resize(componentId + 1, nullptr);
+    }
+
+    // If we still don't have a pool for that component type
+    if (!componentPools[componentId])
+    {
+        componentPools[componentId] = std::make_shared<Pool<TComponent>>();
+    }
+    return static_cast<Pool<TComponent> *>(componentPools[componentId].get());
+}
+
+template <typename TComponent>
+void Registry::RemoveComponent(Entity entity)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    const auto entityId = entity.GetId();
+
+    // Remove the component from the component pool (or the archetype) for that entity
+    if constexpr (IsTagComponent<TComponent>::value)
+    {
+        // Tag components only live in the entity signature
+    }
+    else if (archetypeStorage)
+    {
+        if (entityComponentSignatures[entityId].test(componentId))
+        {
+            archetypeStorage->RemoveComponent(entityId, componentId);
+        }
+    }
+    else if (componentId < static_cast<int>(componentPools.size()) && componentPools[componentId])
+    {
+        RemoveEntityFromGroups(entityId, componentId);
+        componentPools[componentId]->RemoveEntityFromPool(entityId);
+    }
+
+    entityComponentSignatures[entityId].set(componentId, false);
+    OnComponentRemoved(entity, componentId);
+
+    Logger::Log("Component id = ", componentId, " was removed from entity id = ", entityId);
+}
+
+template <typename TComponent>
+bool Registry::HasComponent(Entity entity) const
+{
+    const auto componentId = Component<TComponent>::GetId();
+    const auto entityId = entity.GetId();
+
+    return entityComponentSignatures[entityId].test(componentId);
+}
+
+template <typename TComponent>
+TComponent &Registry::GetComponent(Entity entity) const
+{
+    if constexpr (IsTagComponent<TComponent>::value)
+    {
+        // All the tags of a type are interchangeable, so a single shared object stands for them
+        static TComponent tag;
+        return tag;
+    }
+    else if (archetypeStorage)
+    {
+        return archetypeStorage->template GetComponent<TComponent>(entity.GetId());
+    }
+
+    // Use the raw pool pointer, copying the shared_ptr would touch the reference count on every call
+    return GetComponentPool<TComponent>()->Get(entity.GetId());
+}
+
+template <typename TComponent>
+Pool<TComponent> *Registry::GetComponentPool() const
+{
+    const auto componentId = Component<TComponent>::GetId();
+
+    // Return nullptr if no entity ever had a component of this type
+    if (componentId >= static_cast<int>(componentPools.size()))
+    {
+        return nullptr;
+    }
+    return static_cast<Pool<TComponent> *>(componentPools[componentId].get());
+}
+
+template <typename... TComponents>
+ComponentView<TComponents...> Registry::View()
+{
+    static_assert(!(IsTagComponent<TComponents>::value || ...), "Tag components have no storage to iterate, filter them with a system signature");
+    return ComponentView<TComponents...>(this, archetypeStorage.get(), GetComponentPool<TComponents>()...);
+}
+
+template <typename... TComponents>
+Group<TComponents...> &Registry::GetGroup()
+{
+    static_assert(!(IsTagComponent<TComponents>::value || ...), "Tag components have no storage to group");
+    // The systems look their group up from parallel tasks, so finding it must not modify the map
+    const std::type_index groupType(typeid(Group<TComponents...>));
+    auto existingGroup = groups.find(groupType);
+    if (existingGroup != groups.end())
+    {
+        return static_cast<Group<TComponents...> &>(*existingGroup->second);
+    }
+
+    // The group takes the pools that no other group owns (archetype chunks are already packed)
+    Signature ownedSignature;
+    if (!archetypeStorage)
+    {
+        (GetOrCreateComponentPool<TComponents>(), ...);
+        for (const auto componentId : {Component<TComponents>::GetId()...})
+        {
+            if (componentId >= static_cast<int>(componentOwningGroups.size()) || !componentOwningGroups[componentId])
+            {
+                ownedSignature.set(componentId);
+            }
+        }
+    }
+    auto newGroup = std::make_unique<Group<TComponents...>>(this, ownedSignature, GetComponentPool<TComponents>()...);
+    Group<TComponents...> &groupRef = *newGroup;
+    groups[groupType] = std::move(newGroup);
+    if (!groupRef.IsOwning())
+    {
+        return groupRef;
+    }
+
+    for (const auto componentId : {Component<TComponents>::GetId()...})
+    {
+        if (componentId >= static_cast<int>(componentGroups.size()))
+        {
+            componentGroups.resize(componentId + 1);
+            componentOwningGroups.resize(componentId + 1, nullptr);
+        }
+        componentGroups[componentId].push_back(&groupRef);
+        if (ownedSignature.test(componentId))
+        {
+            componentOwningGroups[componentId] = &groupRef;
+        }
+    }
+
+    // Pack the entities that already have all the components (the ids are copied, packing reorders the pool)
+    typedef std::tuple_element_t<0, std::tuple<TComponents...>> TFirstComponent;
+    const std::vector<int> entityIds = GetComponentPool<TFirstComponent>()->GetEntityIds();
+    for (const auto entityId : entityIds)
+    {
+        groupRef.OnComponentAdded(entityId, entityComponentSignatures[entityId]);
+    }
+    Logger::Log("Group with ", sizeof...(TComponents), " components was created with ", groupRef.GetSize(), " entities");
+    return groupRef;
+}
+
+template <typename TComponent, typename TKey>
+bool Registry::SortComponents(TKey key, int maxMoves)
 {
     const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    Pool<TComponent> *pool = GetComponentPool<TComponent>();
+    // The archetype chunks are not reordered
+    if (archetypeStorage || !pool)
+    {
+        return true;
+    }
+    if (componentId >= static_cast<int>(componentSorts.size()))
+    {
+        componentSorts.resize(componentId + 1);
+    }
+    auto &sort = componentSorts[componentId];
+    IGroup *owningGroup = componentId < static_cast<int>(componentOwningGroups.size()) ? componentOwningGroups[componentId] : nullptr;
 
-    entityComponentSignatures[entityId].set(componentId, false);
+    if (sort.next >= sort.entityIds.size())
+    {
+        // Plan a new pass. The entities of the group that owns the pool stay in front of the others
+        struct SortKey
+        {
+            bool isOutsideGroup;
+            std::uint64_t key;
+            int entityId;
+        };
+        const int groupSize = owningGroup ? owningGroup->GetSize() : 0;
+        std::vector<SortKey> sortKeys;
+        sortKeys.reserve(pool->GetSize());
+        for (int i = 0; i < pool->GetSize(); i++)
+        {
+            const int entityId = pool->GetEntityIdAt(i);
+            sortKeys.push_back({i >= groupSize, key(GetEntityById(entityId)), entityId});
+        }
+        std::sort(sortKeys.begin(), sortKeys.end(), [](const SortKey &a, const SortKey &b)
+                  { return a.isOutsideGroup != b.isOutsideGroup ? b.isOutsideGroup : a.key < b.key; });
 
-    Logger::Log("Component id = ", componentId, " was removed from entity id = ", entityId);
+        sort.entityIds.clear();
+        for (const auto &sortKey : sortKeys)
+        {
+            sort.entityIds.push_back(sortKey.entityId);
+        }
+        sort.next = 0;
+        sort.position = 0;
+    }
+
+    // Place the planned entities one position at a time, entities added since the pass was planned are left at the end
+    int moves = 0;
+    while (moves < maxMoves && sort.next < sort.entityIds.size())
+    {
+        const int entityId = sort.entityIds[sort.next++];
+        const int index = pool->GetIndexOf(entityId);
+        if (index == -1 || sort.position >= pool->GetSize())
+        {
+            // The component was removed since the pass was planned
+            continue;
+        }
+        if (index != sort.position)
+        {
+            if (owningGroup && (index < owningGroup->GetSize() || sort.position < owningGroup->GetSize()))
+            {
+                if ((index < owningGroup->GetSize()) != (sort.position < owningGroup->GetSize()))
+                {
+                    // The entity joined or left the group since the pass was planned
+                    continue;
+                }
+                // The group entities are at the same index in all its pools, they move together
+                owningGroup->SwapEntities(index, sort.position);
+            }
+            else
+            {
+                pool->Swap(index, sort.position);
+            }
+            moves++;
+        }
+        sort.position++;
+    }
+    return sort.next >= sort.entityIds.size();
 }
 
 template <typename TComponent>
-bool Registry::HasComponent(Entity entity) const
+void Registry::MarkChanged(Entity entity)
 {
-    const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    static_assert(!IsTagComponent<TComponent>::value, "Tag components have no data to change");
+    if (archetypeStorage)
+    {
+        archetypeStorage->SetVersion(Component<TComponent>::GetId(), entity.GetId(), version);
+    }
+    else
+    {
+        GetComponentPool<TComponent>()->SetVersion(entity.GetId(), version);
+    }
+}
 
-    return entityComponentSignatures[entityId].test(componentId);
+template <typename TComponent>
+TComponent &Registry::GetMutableComponent(Entity entity)
+{
+    MarkChanged<TComponent>(entity);
+    return GetComponent<TComponent>(entity);
 }
 
 template <typename TComponent>
-TComponent &Registry::GetComponent(Entity entity) const
+std::uint32_t Registry::GetComponentVersion(Entity entity) const
 {
-    const auto componentId = Component<TComponent>::GetId();
-    const auto entityId = entity.GetId();
+    if (archetypeStorage)
+    {
+        return archetypeStorage->GetVersion(Component<TComponent>::GetId(), entity.GetId());
+    }
+    return GetComponentPool<TComponent>()->GetVersion(entity.GetId());
+}
+
+template <typename TComponent>
+ChangedView<TComponent> Registry::Changed(std::uint32_t sinceVersion)
+{
+    static_assert(!IsTagComponent<TComponent>::value, "Tag components have no data to change");
+    return ChangedView<TComponent>(this, archetypeStorage.get(), GetComponentPool<TComponent>(), sinceVersion);
+}
+
+template <typename TComponent>
+template <typename TFunc>
+void ChangedView<TComponent>::each(TFunc func) const
+{
+    if (archetypeStorage)
+    {
+        const auto componentId = Component<TComponent>::GetId();
+        archetypeStorage->template Each<TComponent>([this, &func, componentId](int entityId, TComponent &component)
+                                                    {
+            if (archetypeStorage->GetVersion(componentId, entityId) >= sinceVersion)
+            {
+                func(registry->GetEntityById(entityId), component);
+            } });
+        return;
+    }
+
+    if (!pool)
+    {
+        return;
+    }
+    for (int i = 0; i < pool->GetSize(); i++)
+    {
+        if (pool->GetVersionAt(i) >= sinceVersion)
+        {
+            func(registry->GetEntityById(pool->GetEntityIdAt(i)), (*pool)[i]);
+        }
+    }
+}
+
+template <typename... TComponents>
+const std::vector<int> *ComponentView<TComponents...>::GetSmallestPoolEntityIds() const
+{
+    // If one of the component types was never added, no entity can match
+    if (((std::get<Pool<TComponents> *>(pools) == nullptr) || ...))
+    {
+        return nullptr;
+    }
+
+    // Drive the iteration with the smallest pool, and test the others for membership
+    const std::vector<int> *entityIds = nullptr;
+    auto pickSmallest = [&entityIds](auto *pool)
+    {
+        if (!entityIds || pool->GetSize() < static_cast<int>(entityIds->size()))
+        {
+            entityIds = &pool->GetEntityIds();
+        }
+    };
+    (pickSmallest(std::get<Pool<TComponents> *>(pools)), ...);
+    return entityIds;
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+void ComponentView<TComponents...>::Invoke(TFunc &func, int entityId) const
+{
+    if constexpr (std::is_invocable_v<TFunc, Entity, TComponents &...>)
+    {
+        func(registry->GetEntityById(entityId), std::get<Pool<TComponents> *>(pools)->Get(entityId)...);
+    }
+    else
+    {
+        func(std::get<Pool<TComponents> *>(pools)->Get(entityId)...);
+    }
+}
+
+// Adapts func to the (entityId, TComponents &...) callback used by the archetype storage
+template <typename... TComponents>
+template <typename TFunc>
+auto ComponentView<TComponents...>::WithEntityId(TFunc &func) const
+{
+    return [this, &func](int entityId, TComponents &...components)
+    {
+        if constexpr (std::is_invocable_v<TFunc, Entity, TComponents &...>)
+        {
+            func(registry->GetEntityById(entityId), components...);
+        }
+        else
+        {
+            func(components...);
+        }
+    };
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+void ComponentView<TComponents...>::each(TFunc func) const
+{
+    if (archetypeStorage)
+    {
+        archetypeStorage->template Each<TComponents...>(WithEntityId(func));
+        return;
+    }
+
+    const std::vector<int> *entityIds = GetSmallestPoolEntityIds();
+    if (!entityIds)
+    {
+        return;
+    }
+    for (std::size_t i = 0; i < entityIds->size(); i++)
+    {
+        const int entityId = (*entityIds)[i];
+        if ((std::get<Pool<TComponents> *>(pools)->Has(entityId) && ...))
+        {
+            Invoke(func, entityId);
+        }
+    }
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+void ComponentView<TComponents...>::ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const
+{
+    if (archetypeStorage)
+    {
+        archetypeStorage->template ParallelEach<TComponents...>(threadPool, WithEntityId(func));
+        return;
+    }
 
-    std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(componentPools[componentId]);
-    return componentPool->Get(entityId);
+    const std::vector<int> *entityIds = GetSmallestPoolEntityIds();
+    if (!entityIds)
+    {
+        return;
+    }
+    if (static_cast<int>(entityIds->size()) < PARALLEL_EACH_MIN_ENTITIES)
+    {
+        each(func);
+        return;
+    }
+    threadPool->ParallelFor(entityIds->size(), PARALLEL_EACH_CHUNK_SIZE, [this, entityIds, &func](int begin, int end)
+                            {
+        for (int i = begin; i < end; i++)
+        {
+            const int entityId = (*entityIds)[i];
+            if ((std::get<Pool<TComponents> *>(pools)->Has(entityId) && ...))
+            {
+                Invoke(func, entityId);
+            }
+        } });
 }
 
 template <typename TSystem, typename... TArgs>
@@ -351,12 +2161,15 @@ void Registry::AddSystem(TArgs &&...args)
 {
     std::shared_ptr<TSystem> system = std::make_shared<TSystem>(std::forward<TArgs>(args)...);
     systems.insert(std::make_pair(std::type_index(typeid(TSystem)), system));
+    AddSystemToComponentSystems(system.get());
 }
 
 template <typename TSystem>
 void Registry::RemoveSystem()
 {
     auto system = systems.find(std::type_index(typeid(TSystem)));
+    RemoveSystemFromComponentSystems(system->second.get());
+    RemoveSystemFromSchedule(system->second.get());
     systems.erase(system);
 }
 
@@ -373,4 +2186,376 @@ TSystem &Registry::GetSystem() const
     return *(std::static_pointer_cast<TSystem>(system->second));
 }
 
+// Adds a system to the per-frame schedule, update is called as update(TSystem &)
+// Example: registry->ScheduleSystem<MovementSystem>([&](MovementSystem &system) { system.Update(registry, deltaTime); })
+template <typename TSystem, typename TFunc>
+void Registry::ScheduleSystem(TFunc update)
+{
+    TSystem &system = GetSystem<TSystem>();
+
+    ScheduledSystem scheduledSystem;
+    scheduledSystem.system = &system;
+    scheduledSystem.update = [&system, update]()
+    { update(system); };
+
+    // The new system must wait for every earlier system it conflicts with
+    const int index = schedule.size();
+    for (auto &other : schedule)
+    {
+        if (other.system->ConflictsWith(system))
+        {
+            other.dependents.push_back(index);
+            scheduledSystem.numDependencies++;
+        }
+    }
+    schedule.push_back(std::move(scheduledSystem));
+}
+
+template <typename TComponent, typename... TArgs>
+void CommandBuffer::AddComponent(Entity entity, TArgs &&...args)
+{
+    // The component is constructed right away in the buffer memory, and moved into the registry on playback
+    TComponent *component = payloads.template Create<TComponent>(std::forward<TArgs>(args)...);
+    commands.push_back({CommandType::AddComponent, sortKey, entity, component,
+                        [](Registry &registry, Entity entity, void *payload)
+                        { registry.template AddComponent<TComponent>(entity, std::move(*static_cast<TComponent *>(payload))); },
+                        [](void *payload)
+                        { static_cast<TComponent *>(payload)->~TComponent(); }});
+}
+
+template <typename TComponent>
+void CommandBuffer::RemoveComponent(Entity entity)
+{
+    commands.push_back({CommandType::RemoveComponent, sortKey, entity, nullptr,
+                        [](Registry &registry, Entity entity, void *)
+                        { registry.template RemoveComponent<TComponent>(entity); },
+                        nullptr});
+}
+
+template <typename... TOverrides>
+Entity CommandBuffer::Instantiate(const Prefab &prefab, TOverrides &&...overrides)
+{
+    Entity entity = CreateEntity();
+    PrefabPayload *payload = payloads.template Create<PrefabPayload>();
+    payload->prefab = &prefab;
+    payload->skipSignature = MakeSignature<std::decay_t<TOverrides>...>();
+    commands.push_back({CommandType::InstantiatePrefab, sortKey, entity, payload,
+                        [](Registry &registry, Entity entity, void *payload)
+                        {
+                            const auto *prefabPayload = static_cast<PrefabPayload *>(payload);
+                            prefabPayload->prefab->CopyTo(registry, entity, prefabPayload->skipSignature);
+                        },
+                        nullptr});
+    (AddComponent<std::decay_t<TOverrides>>(entity, std::forward<TOverrides>(overrides)), ...);
+    return entity;
+}
+
+template <typename... TComponents>
+Group<TComponents...>::Group(Registry *registry, const Signature &ownedSignature, Pool<TComponents> *...pools)
+    : registry(registry), pools(pools...), ownedPools((ownedSignature.test(Component<TComponents>::GetId()) ? pools : nullptr)...),
+      signature(MakeSignature<TComponents...>()), ownedSignature(ownedSignature)
+{
+}
+
+template <typename... TComponents>
+int Group<TComponents...>::GetSize() const
+{
+    return size;
+}
+
+template <typename... TComponents>
+void Group<TComponents...>::SwapEntities(int indexA, int indexB)
+{
+    ((IsOwned<TComponents>() ? std::get<Pool<TComponents> *>(pools)->Swap(indexA, indexB) : void()), ...);
+}
+
+template <typename... TComponents>
+bool Group<TComponents...>::IsOwning() const
+{
+    return ownedSignature.any();
+}
+
+template <typename... TComponents>
+template <typename TComponent>
+bool Group<TComponents...>::IsOwned() const
+{
+    return std::get<Pool<TComponent> *>(ownedPools) != nullptr;
+}
+
+// Owned components are at the same index in every owned pool, the others are looked up by entity id
+template <typename... TComponents>
+template <typename TComponent>
+TComponent &Group<TComponents...>::GetComponentAt(int index, int entityId) const
+{
+    if (Pool<TComponent> *ownedPool = std::get<Pool<TComponent> *>(ownedPools))
+    {
+        return (*ownedPool)[index];
+    }
+    return std::get<Pool<TComponent> *>(pools)->Get(entityId == -1 ? GetEntityIdAt(index) : entityId);
+}
+
+template <typename... TComponents>
+int Group<TComponents...>::GetIndexOf(int entityId) const
+{
+    // All the owned pools agree on the index, so the first one is enough
+    int index = -1;
+    ((IsOwned<TComponents>() && (index = std::get<Pool<TComponents> *>(pools)->GetIndexOf(entityId), true)) || ...);
+    return index;
+}
+
+template <typename... TComponents>
+int Group<TComponents...>::GetEntityIdAt(int index) const
+{
+    int entityId = -1;
+    ((IsOwned<TComponents>() && (entityId = std::get<Pool<TComponents> *>(pools)->GetEntityIdAt(index), true)) || ...);
+    return entityId;
+}
+
+template <typename... TComponents>
+void Group<TComponents...>::MoveToIndex(int entityId, int index)
+{
+    // Outside of the group the entity can be at a different index in each pool
+    auto moveInPool = [entityId, index](auto *pool)
+    { pool->Swap(pool->GetIndexOf(entityId), index); };
+    ((IsOwned<TComponents>() ? moveInPool(std::get<Pool<TComponents> *>(pools)) : void()), ...);
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+auto Group<TComponents...>::Invoke(TFunc &func, int index) const
+{
+    if constexpr (std::is_invocable_v<TFunc, Entity, TComponents &...>)
+    {
+        const int entityId = GetEntityIdAt(index);
+        return func(registry->GetEntityById(entityId), GetComponentAt<TComponents>(index, entityId)...);
+    }
+    else
+    {
+        return func(GetComponentAt<TComponents>(index, -1)...);
+    }
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+void Group<TComponents...>::each(TFunc func) const
+{
+    if (!IsOwning())
+    {
+        registry->template View<TComponents...>().each(func);
+        return;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        Invoke(func, i);
+    }
+}
+
+template <typename... TComponents>
+template <typename TFunc>
+void Group<TComponents...>::ParallelEach(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const
+{
+    if (!IsOwning())
+    {
+        registry->template View<TComponents...>().ParallelEach(threadPool, func);
+        return;
+    }
+
+    if (size < PARALLEL_EACH_MIN_ENTITIES)
+    {
+        each(func);
+        return;
+    }
+    threadPool->ParallelFor(size, PARALLEL_EACH_CHUNK_SIZE, [this, &func](int begin, int end)
+                            {
+        for (int i = begin; i < end; i++)
+        {
+            Invoke(func, i);
+        } });
+}
+
+template <typename... TComponents>
+template <typename TChanged, typename TFunc>
+void Group<TComponents...>::ParallelEachMarkChanged(std::unique_ptr<ThreadPool> &threadPool, TFunc func) const
+{
+    static_assert(!IsTagComponent<TChanged>::value, "Tag components have no data to change");
+    Pool<TChanged> *ownedPool = std::get<Pool<TChanged> *>(ownedPools);
+    if (!ownedPool)
+    {
+        // The pool order isn't the group order, so the version goes through the entity lookup
+        ParallelEach(threadPool, [this, &func](Entity entity, TComponents &...components)
+                     {
+            bool changed;
+            if constexpr (std::is_invocable_v<TFunc, Entity, TComponents &...>)
+            {
+                changed = func(entity, components...);
+            }
+            else
+            {
+                changed = func(components...);
+            }
+            if (changed)
+            {
+                registry->template MarkChanged<TChanged>(entity);
+            } });
+        return;
+    }
+
+    const std::uint32_t version = registry->GetVersion();
+    auto eachInRange = [this, &func, ownedPool, version](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            if (Invoke(func, i))
+            {
+                ownedPool->SetVersionAt(i, version);
+            }
+        }
+    };
+    if (size < PARALLEL_EACH_MIN_ENTITIES)
+    {
+        eachInRange(0, size);
+        return;
+    }
+    threadPool->ParallelFor(size, PARALLEL_EACH_CHUNK_SIZE, eachInRange);
+}
+
+// An entity joins the group when it has all the components: it is swapped to the end of the packed range
+template <typename... TComponents>
+void Group<TComponents...>::OnComponentAdded(int entityId, const Signature &entityComponentSignature)
+{
+    if ((entityComponentSignature & signature) != signature)
+    {
+        return;
+    }
+    if (GetIndexOf(entityId) < size)
+    {
+        return;
+    }
+    MoveToIndex(entityId, size);
+    size++;
+}
+
+// An entity leaves the group by swapping places with the last entity of the packed range
+template <typename... TComponents>
+void Group<TComponents...>::OnComponentRemoved(int entityId)
+{
+    const int index = GetIndexOf(entityId);
+    if (index == -1 || index >= size)
+    {
+        return;
+    }
+    size--;
+    MoveToIndex(entityId, size);
+}
+
+template <typename TComponent>
+Shared<TComponent>::Shared(const Shared &other) : instance(other.instance)
+{
+    if (instance)
+    {
+        instance->useCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename TComponent>
+Shared<TComponent>::Shared(Shared &&other) noexcept : instance(other.instance)
+{
+    other.instance = nullptr;
+}
+
+template <typename TComponent>
+Shared<TComponent> &Shared<TComponent>::operator=(Shared other) noexcept
+{
+    std::swap(instance, other.instance);
+    return *this;
+}
+
+template <typename TComponent>
+Shared<TComponent>::~Shared()
+{
+    Release();
+}
+
+template <typename TComponent>
+void Shared<TComponent>::Release()
+{
+    if (instance && instance->useCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete instance;
+    }
+    instance = nullptr;
+}
+
+template <typename TComponent>
+template <typename... TArgs>
+Shared<TComponent> Shared<TComponent>::Create(TArgs &&...args)
+{
+    return Shared(new Instance(std::forward<TArgs>(args)...));
+}
+
+template <typename TComponent>
+bool Shared<TComponent>::IsValid() const
+{
+    return instance != nullptr;
+}
+
+template <typename TComponent>
+int Shared<TComponent>::GetUseCount() const
+{
+    return instance ? instance->useCount.load(std::memory_order_relaxed) : 0;
+}
+
+template <typename TComponent>
+const TComponent &Shared<TComponent>::Get() const
+{
+    return instance->component;
+}
+
+template <typename TComponent>
+const TComponent *Shared<TComponent>::operator->() const
+{
+    return &instance->component;
+}
+
+template <typename TComponent>
+TComponent &Shared<TComponent>::Write()
+{
+    if (instance->useCount.load(std::memory_order_acquire) > 1)
+    {
+        Shared copy(new Instance(instance->component));
+        std::swap(instance, copy.instance);
+    }
+    return instance->component;
+}
+
+template <typename TComponent, typename... TArgs>
+Prefab &Prefab::AddComponent(TArgs &&...args)
+{
+    const auto componentId = Component<TComponent>::GetId();
+    std::shared_ptr<void> component = std::make_shared<TComponent>(std::forward<TArgs>(args)...);
+    auto copyTo = [](Registry &registry, Entity entity, const void *component)
+    { registry.template AddComponent<TComponent>(entity, *static_cast<const TComponent *>(component)); };
+
+    for (auto &prefabComponent : components)
+    {
+        if (prefabComponent.componentId == componentId)
+        {
+            prefabComponent.component = std::move(component);
+            return *this;
+        }
+    }
+    components.push_back({componentId, std::move(component), copyTo});
+    return *this;
+}
+
+template <typename... TOverrides>
+Entity Registry::Instantiate(const Prefab &prefab, TOverrides &&...overrides)
+{
+    Entity entity = CreateEntity();
+    prefab.CopyTo(*this, entity, MakeSignature<std::decay_t<TOverrides>...>());
+    (AddComponent<std::decay_t<TOverrides>>(entity, std::forward<TOverrides>(overrides)), ...);
+    return entity;
+}
+
 #endif
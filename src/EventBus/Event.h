@@ -1,10 +1,74 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <atomic>
+#include <type_traits>
+
+#include "../Events/EventTypes.h"
+
+// Maximum number of event types, it can be raised at build time (e.g. -DEVENTBUS_MAX_EVENT_TYPES=256)
+#ifndef EVENTBUS_MAX_EVENT_TYPES
+#define EVENTBUS_MAX_EVENT_TYPES 64
+#endif
+const unsigned int MAX_EVENT_TYPES = EVENTBUS_MAX_EVENT_TYPES;
+
 class Event
 {
 public:
     Event() = default;
 };
 
+// List of event types, the position of a type in the list is its id
+template <typename... TEvents>
+struct EventTypeList
+{
+    static constexpr int size = sizeof...(TEvents);
+
+    // Position of the event type in the list (-1 = not in the list)
+    template <typename TEvent>
+    static constexpr int IndexOf()
+    {
+        constexpr bool isSame[] = {std::is_same<TEvent, TEvents>::value..., false};
+        for (int i = 0; i < size; i++)
+        {
+            if (isSame[i])
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+static_assert(RegisteredEventTypes::size <= static_cast<int>(MAX_EVENT_TYPES), "Too many registered event types, raise EVENTBUS_MAX_EVENT_TYPES");
+
+struct IEventType
+{
+protected:
+    // The ids assigned at runtime start after the ones of RegisteredEventTypes
+    static inline std::atomic<int> nextId{RegisteredEventTypes::size};
+};
+
+// Used to assign a unique ID to an event type, the EventBus uses it as an index
+template <typename TEvent>
+class EventType : public IEventType
+{
+public:
+    // Compile-time ID of the types listed in RegisteredEventTypes (-1 for the other types)
+    static constexpr int staticId = RegisteredEventTypes::template IndexOf<TEvent>();
+
+    static int GetId()
+    {
+        if constexpr (staticId != -1)
+        {
+            return staticId;
+        }
+        else
+        {
+            static auto id = nextId++;
+            return id;
+        }
+    }
+};
+
 #endif
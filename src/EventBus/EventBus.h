@@ -1,60 +1,539 @@
 #ifndef EVENTBUS_H
 #define EVENTBUS_H
 
-#include <map>
-#include <list>
-#include <typeindex>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <string_view>
+#include <type_traits>
 
 #include "./Event.h"
+#include "./EventQueue.h"
+#include "../Memory/LinearArena.h"
 #include "../ECS/ECS.h"
 #include "../Logger/Logger.h"
 
-class IEventCallback
+// Contiguous range of events of the same type, handed to the listeners of event batches
+template <typename TEvent>
+class EventSpan
 {
 private:
-    virtual void Call(Event &e) = 0;
+    TEvent *events;
+    std::size_t size;
 
 public:
-    virtual ~IEventCallback() = default;
-    void Execute(Event &e)
+    EventSpan(TEvent *events, std::size_t size) : events(events), size(size) {}
+
+    TEvent *begin() const
+    {
+        return events;
+    }
+
+    TEvent *end() const
+    {
+        return events + size;
+    }
+
+    std::size_t GetSize() const
     {
-        Call(e);
+        return size;
+    }
+
+    bool IsEmpty() const
+    {
+        return size == 0;
+    }
+
+    TEvent &operator[](std::size_t index) const
+    {
+        return events[index];
     }
 };
 
-template <typename TOwner, typename TEvent>
-class EventCallback : public IEventCallback
+////////////////////////////////////////////////////////////////////////////////////////
+// EventHandler
+////////////////////////////////////////////////////////////////////////////////////////
+// A listener is stored as a plain function pointer and the instance it is called on.
+// The function is generated per member function, so calling a handler is one indirect
+// call straight into the member function, without virtual calls in between.
+// Batch handlers take all the queued events of a type at once
+////////////////////////////////////////////////////////////////////////////////////////
+struct EventHandler
 {
-private:
-    typedef void (TOwner::*CallbackFunction)(TEvent &);
+    typedef void (*CallbackFunction)(void *ownerInstance, Event &e);
 
-    TOwner *ownerInstance;
     CallbackFunction callbackFunction;
+    void *ownerInstance;
+    std::uint64_t subscriptionId;
+};
+
+struct EventBatchHandler
+{
+    typedef void (*CallbackFunction)(void *ownerInstance, void *events, std::size_t numEvents);
+
+    CallbackFunction callbackFunction;
+    void *ownerInstance;
+    std::uint64_t subscriptionId;
+};
+
+struct EventChannel;
+
+// Events of one type waiting for the next DispatchQueuedEvents()
+class IChannelQueue
+{
+public:
+    virtual ~IChannelQueue() = default;
+    virtual void Dispatch(EventChannel &channel) = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// EventChannel
+////////////////////////////////////////////////////////////////////////////////////////
+// The handlers of one event type, stored contiguously in the order they subscribed,
+// and the queue of the events of that type
+////////////////////////////////////////////////////////////////////////////////////////
+struct EventChannel
+{
+    std::vector<EventHandler> handlers;
+    std::vector<EventBatchHandler> batchHandlers;
+    std::unique_ptr<IChannelQueue> queue;
+    std::uint64_t nextSubscriptionId = 0;
+    // Handlers removed while the event is being emitted are only cleared (null callback),
+    // they are erased when the outermost emit is done so the indices stay valid
+    int emitDepth = 0;
+    bool hasRemovedHandlers = false;
+
+    bool HasHandlers() const
+    {
+        return !handlers.empty() || !batchHandlers.empty();
+    }
+
+    void Remove(std::uint64_t subscriptionId)
+    {
+        RemoveFrom(handlers, subscriptionId);
+        RemoveFrom(batchHandlers, subscriptionId);
+    }
+
+    void BeginEmit()
+    {
+        emitDepth++;
+    }
+
+    void EndEmit()
+    {
+        emitDepth--;
+        if (emitDepth == 0 && hasRemovedHandlers)
+        {
+            EraseRemovedHandlers(handlers);
+            EraseRemovedHandlers(batchHandlers);
+            hasRemovedHandlers = false;
+        }
+    }
+
+private:
+    template <typename THandler>
+    void RemoveFrom(std::vector<THandler> &handlerList, std::uint64_t subscriptionId)
+    {
+        auto handler = std::find_if(handlerList.begin(), handlerList.end(), [subscriptionId](const THandler &handler)
+                                    { return handler.subscriptionId == subscriptionId; });
+        if (handler == handlerList.end())
+        {
+            return;
+        }
+        if (emitDepth > 0)
+        {
+            handler->callbackFunction = nullptr;
+            hasRemovedHandlers = true;
+        }
+        else
+        {
+            handlerList.erase(handler);
+        }
+    }
+
+    template <typename THandler>
+    static void EraseRemovedHandlers(std::vector<THandler> &handlerList)
+    {
+        handlerList.erase(std::remove_if(handlerList.begin(), handlerList.end(), [](const THandler &handler)
+                                         { return handler.callbackFunction == nullptr; }),
+                          handlerList.end());
+    }
+};
+
+// Calls the handlers of the channel with a range of events.
+// Indexed loops, a listener may subscribe (and grow the vectors) while it is called.
+// The listeners that subscribe during the emit get the next events
+template <typename TEvent>
+void DispatchEvents(EventChannel &channel, TEvent *events, std::size_t numEvents)
+{
+    channel.BeginEmit();
+    const auto numBatchHandlers = channel.batchHandlers.size();
+    for (std::size_t i = 0; i < numBatchHandlers; i++)
+    {
+        const auto handler = channel.batchHandlers[i];
+        if (handler.callbackFunction)
+        {
+            handler.callbackFunction(handler.ownerInstance, events, numEvents);
+        }
+    }
+    const auto numHandlers = channel.handlers.size();
+    for (std::size_t e = 0; e < numEvents; e++)
+    {
+        for (std::size_t i = 0; i < numHandlers; i++)
+        {
+            const auto handler = channel.handlers[i];
+            if (handler.callbackFunction)
+            {
+                handler.callbackFunction(handler.ownerInstance, events[e]);
+            }
+        }
+    }
+    channel.EndEmit();
+}
+
+template <typename TEvent>
+class ChannelQueue : public IChannelQueue
+{
+private:
+    // Filled by any thread
+    EventQueue<TEvent> events;
+    // The events being dispatched, the listeners can queue new events in the meantime.
+    // The vector keeps its capacity, so a steady stream of events doesn't allocate
+    std::vector<TEvent> dispatchedEvents;
+
+public:
+    template <typename... TArgs>
+    void Push(TArgs &&...args)
+    {
+        events.Push(std::forward<TArgs>(args)...);
+    }
+
+    void Dispatch(EventChannel &channel) override
+    {
+        events.Drain(dispatchedEvents);
+        DispatchEvents(channel, dispatchedEvents.data(), dispatchedEvents.size());
+        dispatchedEvents.clear();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Event payloads
+////////////////////////////////////////////////////////////////////////////////////////
+// Data too big (or too variable) to be copied into every event is allocated from the
+// frame arenas of the EventBus, and the event only carries the accessor. The arenas are
+// double-buffered: every DispatchQueuedEvents() starts a new generation of payloads, and
+// releases the generation before the current one, whose events it has all delivered.
+// So a payload stays valid until the end of the second DispatchQueuedEvents() after it
+// was created, which covers the events queued by the listeners for the next frame
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class EventPayload
+{
+private:
+    T *payload = nullptr;
+
+public:
+    EventPayload() = default;
+    explicit EventPayload(T *payload) : payload(payload) {}
+
+    bool IsValid() const
+    {
+        return payload != nullptr;
+    }
+
+    T &Get() const
+    {
+        return *payload;
+    }
+
+    T &operator*() const
+    {
+        return *payload;
+    }
+
+    T *operator->() const
+    {
+        return payload;
+    }
+};
+
+// Arena of the payloads allocated by one thread during one generation
+class FrameArena
+{
+private:
+    struct Destructor
+    {
+        void *payload;
+        std::size_t numElements;
+        void (*destroy)(void *payload, std::size_t numElements);
+    };
+
+    std::thread::id threadId;
+    LinearArena arena;
+    // Payloads that need their destructor called at the end of the frame
+    std::vector<Destructor> destructors;
+
+    template <typename T>
+    void AddDestructor(T *elements, std::size_t numElements)
+    {
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            destructors.push_back({elements, numElements, [](void *payload, std::size_t numElements)
+                                   {
+                                       for (std::size_t i = 0; i < numElements; i++)
+                                       {
+                                           static_cast<T *>(payload)[i].~T();
+                                       }
+                                   }});
+        }
+    }
+
+    friend class EventBus;
+
+public:
+    explicit FrameArena(std::thread::id threadId) : threadId(threadId) {}
+    FrameArena(const FrameArena &) = delete;
+    ~FrameArena()
+    {
+        Reset();
+    }
 
-    virtual void Call(Event &e) override
+    template <typename T, typename... TArgs>
+    T *Create(TArgs &&...args)
     {
-        std::invoke(callbackFunction, ownerInstance, static_cast<TEvent &>(e));
+        T *element = arena.Create<T>(std::forward<TArgs>(args)...);
+        AddDestructor(element, 1);
+        return element;
     }
 
+    template <typename T, typename... TArgs>
+    T *CreateArray(std::size_t numElements, const TArgs &...args)
+    {
+        T *elements = static_cast<T *>(arena.Allocate(sizeof(T) * numElements, alignof(T)));
+        for (std::size_t i = 0; i < numElements; i++)
+        {
+            new (elements + i) T(args...);
+        }
+        AddDestructor(elements, numElements);
+        return elements;
+    }
+
+    // Destroys the payloads and makes the memory available again, without freeing it
+    void Reset()
+    {
+        for (const auto &destructor : destructors)
+        {
+            destructor.destroy(destructor.payload, destructor.numElements);
+        }
+        destructors.clear();
+        arena.Reset();
+    }
+
+    std::size_t GetCapacity() const
+    {
+        return arena.GetCapacity();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+// EventSubscription
+////////////////////////////////////////////////////////////////////////////////////////
+// Keeps a callback subscribed until the subscription is destroyed or Unsubscribe() is
+// called. It only holds a weak reference to the channel, so it can outlive the bus
+////////////////////////////////////////////////////////////////////////////////////////
+class EventSubscription
+{
+private:
+    std::weak_ptr<EventChannel> channel;
+    std::uint64_t subscriptionId = 0;
+
 public:
-    EventCallback(TOwner *ownerInstance, CallbackFunction callbackFunction)
+    EventSubscription() = default;
+    EventSubscription(std::weak_ptr<EventChannel> channel, std::uint64_t subscriptionId)
+        : channel(std::move(channel)), subscriptionId(subscriptionId) {}
+    EventSubscription(const EventSubscription &) = delete;
+    EventSubscription &operator=(const EventSubscription &) = delete;
+    EventSubscription(EventSubscription &&other) noexcept
+        : channel(std::move(other.channel)), subscriptionId(other.subscriptionId)
+    {
+        other.channel.reset();
+    }
+    EventSubscription &operator=(EventSubscription &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Unsubscribe();
+            channel = std::move(other.channel);
+            subscriptionId = other.subscriptionId;
+            other.channel.reset();
+        }
+        return *this;
+    }
+    ~EventSubscription()
+    {
+        Unsubscribe();
+    }
+
+    bool IsSubscribed() const
+    {
+        return !channel.expired();
+    }
+
+    void Unsubscribe()
     {
-        this->ownerInstance = ownerInstance;
-        this->callbackFunction = callbackFunction;
+        if (auto eventChannel = channel.lock())
+        {
+            eventChannel->Remove(subscriptionId);
+        }
+        channel.reset();
     }
-    virtual ~EventCallback() override = default;
 };
 
-typedef std::list<std::unique_ptr<IEventCallback>>
-    HandlerList;
+// Deduces the owner and the event type of a member function used as an event callback,
+// the callback takes either one event or a span of events (batch)
+template <typename TCallback>
+struct EventCallbackTraits;
+
+template <typename TOwner, typename TEvent>
+struct EventCallbackTraits<void (TOwner::*)(TEvent &)>
+{
+    typedef TOwner Owner;
+    typedef TEvent EventType;
+    static constexpr bool isBatch = false;
+};
+
+template <typename TOwner, typename TEvent>
+struct EventCallbackTraits<void (TOwner::*)(EventSpan<TEvent>)>
+{
+    typedef TOwner Owner;
+    typedef TEvent EventType;
+    static constexpr bool isBatch = true;
+};
 
+////////////////////////////////////////////////////////////////////////////////////////
+// EventBus
+////////////////////////////////////////////////////////////////////////////////////////
+// Subscribing, emitting and dispatching happen on one thread at a time (the main thread,
+// or the system that is running). QueueEvent can be called from any thread, the events
+// are delivered by the next DispatchQueuedEvents()
+////////////////////////////////////////////////////////////////////////////////////////
 class EventBus
 {
 private:
-    std::map<std::type_index, std::unique_ptr<HandlerList>> subscribers;
+    // Channels indexed by the id of the event type (EventType<TEvent>::GetId())
+    std::vector<std::shared_ptr<EventChannel>> channels;
+    // Copy of the channel pointers that QueueEvent reads from the other threads,
+    // a channel is published once its queue exists and stays until Reset()
+    std::atomic<EventChannel *> queueChannels[MAX_EVENT_TYPES] = {};
+
+    // Payload arenas, one per thread that allocated payloads (the same as the command buffers),
+    // for each of the two generations in use [Array index = generation % 2]
+    const int eventBusId;
+    static inline std::atomic<int> nextEventBusId{0};
+    std::atomic<std::uint64_t> frameGeneration{0};
+    std::vector<std::unique_ptr<FrameArena>> frameArenas[2];
+    // Threads allocating from the arenas of each generation, a generation is only reset once it drops to zero
+    std::atomic<int> numAllocatingThreads[2] = {};
+    std::mutex frameArenasMutex;
+
+    // Returns the arena of the calling thread for the generation, creating it the first time
+    FrameArena &GetFrameArena(std::uint64_t generation)
+    {
+        // Every thread caches the arena it got for the last bus and generation it used
+        static thread_local int cachedEventBusId = -1;
+        static thread_local std::uint64_t cachedGeneration = 0;
+        static thread_local FrameArena *cachedFrameArena = nullptr;
+        if (cachedEventBusId != eventBusId || cachedGeneration != generation)
+        {
+            std::lock_guard<std::mutex> lock(frameArenasMutex);
+            auto &generationArenas = frameArenas[generation % 2];
+            const auto threadId = std::this_thread::get_id();
+            auto frameArena = std::find_if(generationArenas.begin(), generationArenas.end(), [threadId](const std::unique_ptr<FrameArena> &frameArena)
+                                           { return frameArena->threadId == threadId; });
+            if (frameArena == generationArenas.end())
+            {
+                generationArenas.push_back(std::make_unique<FrameArena>(threadId));
+                frameArena = generationArenas.end() - 1;
+            }
+            cachedEventBusId = eventBusId;
+            cachedGeneration = generation;
+            cachedFrameArena = frameArena->get();
+        }
+        return *cachedFrameArena;
+    }
+
+    // Calls allocate(frameArena) with the arena of the calling thread for the current generation.
+    // The thread counts itself in the generation before checking it is still the current one,
+    // so StartFrameGeneration() never resets an arena while it is being allocated from
+    template <typename TAllocate>
+    auto AllocateFromFrameArena(TAllocate allocate)
+    {
+        while (true)
+        {
+            const auto generation = frameGeneration.load();
+            auto &numAllocating = numAllocatingThreads[generation % 2];
+            numAllocating++;
+            if (frameGeneration.load() == generation)
+            {
+                auto payload = allocate(GetFrameArena(generation));
+                numAllocating--;
+                return payload;
+            }
+            numAllocating--;
+        }
+    }
+
+    // Releases the payloads of the previous generation and makes their arenas the current ones.
+    // Only called by the consumer thread, at the end of DispatchQueuedEvents()
+    void StartFrameGeneration()
+    {
+        const auto nextGeneration = frameGeneration.load() + 1;
+        auto &numAllocating = numAllocatingThreads[nextGeneration % 2];
+        // Wait for the threads that are still finishing an allocation in the previous generation
+        while (numAllocating > 0)
+        {
+            std::this_thread::yield();
+        }
+        {
+            std::lock_guard<std::mutex> lock(frameArenasMutex);
+            for (auto &frameArena : frameArenas[nextGeneration % 2])
+            {
+                frameArena->Reset();
+            }
+        }
+        frameGeneration.store(nextGeneration);
+    }
+
+    template <auto Callback>
+    static void Invoke(void *ownerInstance, Event &e)
+    {
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        (static_cast<typename Traits::Owner *>(ownerInstance)->*Callback)(static_cast<typename Traits::EventType &>(e));
+    }
+
+    template <auto Callback>
+    static void InvokeBatch(void *ownerInstance, void *events, std::size_t numEvents)
+    {
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        typedef typename Traits::EventType TEvent;
+        (static_cast<typename Traits::Owner *>(ownerInstance)->*Callback)(EventSpan<TEvent>(static_cast<TEvent *>(events), numEvents));
+    }
+
+    // Returns the channel of the event type, nullptr if nobody subscribed to it
+    template <typename TEvent>
+    EventChannel *FindChannel() const
+    {
+        const auto eventTypeId = static_cast<std::size_t>(EventType<TEvent>::GetId());
+        return eventTypeId < channels.size() ? channels[eventTypeId].get() : nullptr;
+    }
 
 public:
-    EventBus()
+    EventBus() : eventBusId(nextEventBusId++)
     {
         Logger::Log("EventBus constructor called!");
     }
@@ -64,46 +543,151 @@ public:
     }
 
     /////////////////////////////////////////////////////////////////////////////////////////////////
-    // Subscribe to an event type <TEvent>
-    // In our implementation, a listener subscribes to an event
-    // Example: eventBus->SubscribeToEvent<CollisionEvent>(this, &Game::onCollision)
+    // Subscribe a member function to the event type it takes
+    // In our implementation, a listener subscribes to an event once and stays subscribed
+    // until the returned subscription is destroyed (or Unsubscribe() is called on it).
+    // A member function taking an EventSpan<TEvent> receives the events in batches
+    // Example: subscription = eventBus->SubscribeToEvent<&Game::onCollision>(this)
     /////////////////////////////////////////////////////////////////////////////////////////////////
-    template <typename TEvent, typename TOwner>
-    void SubscribeToEvent(TOwner *ownerInstance, void (TOwner::*callbackFunction)(TEvent &))
+    template <auto Callback>
+    [[nodiscard]] EventSubscription SubscribeToEvent(typename EventCallbackTraits<decltype(Callback)>::Owner *ownerInstance)
     {
-        if (!subscribers[std::type_index(typeid(TEvent))].get())
+        typedef EventCallbackTraits<decltype(Callback)> Traits;
+        typedef typename Traits::EventType TEvent;
+        const auto eventTypeId = static_cast<std::size_t>(EventType<TEvent>::GetId());
+        if (eventTypeId >= MAX_EVENT_TYPES)
+        {
+            Logger::Err("Event type id = ", eventTypeId, " exceeds the maximum number of event types, raise EVENTBUS_MAX_EVENT_TYPES");
+            return EventSubscription();
+        }
+        if (eventTypeId >= channels.size())
+        {
+            channels.resize(eventTypeId + 1);
+        }
+        auto &channel = channels[eventTypeId];
+        if (!channel)
         {
-            subscribers[std::type_index(typeid(TEvent))] = std::make_unique<HandlerList>();
+            channel = std::make_shared<EventChannel>();
+            channel->queue = std::make_unique<ChannelQueue<TEvent>>();
+            queueChannels[eventTypeId].store(channel.get(), std::memory_order_release);
         }
-        auto subscriber = std::make_unique<EventCallback<TOwner, TEvent>>(ownerInstance, callbackFunction);
-        subscribers[std::type_index(typeid(TEvent))]->push_back(std::move(subscriber));
+        const auto subscriptionId = channel->nextSubscriptionId++;
+        if constexpr (Traits::isBatch)
+        {
+            channel->batchHandlers.push_back({&InvokeBatch<Callback>, ownerInstance, subscriptionId});
+        }
+        else
+        {
+            channel->handlers.push_back({&Invoke<Callback>, ownerInstance, subscriptionId});
+        }
+        return EventSubscription(channel, subscriptionId);
     }
 
     /////////////////////////////////////////////////////////////////////////////////////////////////
     // Emit an event of type <TEvent>
     // In our implementation, as soon as somthing emits an event
-    // we go ahead and execute all the listener callback functions
+    // we go ahead and execute all the listener callback functions.
+    // The event is constructed once and the same object is passed to all the listeners
     // Example: eventBus->EmitEvent<CollisionEvent>(player, enemy)
     /////////////////////////////////////////////////////////////////////////////////////////////////
     template <typename TEvent, typename... TArgs>
     void EmitEvent(TArgs &&...args)
     {
-        auto handlers = subscribers[std::type_index(typeid(TEvent))].get();
-        if (handlers)
+        auto channel = FindChannel<TEvent>();
+        if (!channel || !channel->HasHandlers())
+        {
+            return;
+        }
+        TEvent e(std::forward<TArgs>(args)...);
+        DispatchEvents(*channel, &e, 1);
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////
+    // Queue an event of type <TEvent>
+    // The event is appended to the queue of its type, and the listeners get it on the next
+    // DispatchQueuedEvents(). It can be called from any thread, the queues are lock-free.
+    // Events of a type nobody ever subscribed to are dropped right away.
+    // They are delivered sorted by their sort key (see EventSortKeyScope), then by producer thread and queue order
+    // Example: eventBus->QueueEvent<CollisionEvent>(player, enemy)
+    /////////////////////////////////////////////////////////////////////////////////////////////////
+    template <typename TEvent, typename... TArgs>
+    void QueueEvent(TArgs &&...args)
+    {
+        const auto eventTypeId = static_cast<std::size_t>(EventType<TEvent>::GetId());
+        auto channel = eventTypeId < MAX_EVENT_TYPES ? queueChannels[eventTypeId].load(std::memory_order_acquire) : nullptr;
+        if (!channel)
+        {
+            return;
+        }
+        static_cast<ChannelQueue<TEvent> *>(channel->queue.get())->Push(std::forward<TArgs>(args)...);
+    }
+
+    // Delivers the queued events of type <TEvent>, the batch listeners get all of them at once
+    template <typename TEvent>
+    void DispatchQueuedEvents()
+    {
+        if (auto channel = FindChannel<TEvent>())
+        {
+            channel->queue->Dispatch(*channel);
+        }
+    }
+
+    // Delivers the queued events of all the types, in the order of the event type ids.
+    // This is the sync point of the frame, it also starts a new generation of payloads
+    void DispatchQueuedEvents()
+    {
+        for (std::size_t i = 0; i < channels.size(); i++)
         {
-            for (auto it = handlers->begin(); it != handlers->end(); it++)
+            if (channels[i])
             {
-                auto handler = it->get();
-                TEvent e(std::forward<TArgs>(args)...);
-                handler->Execute(e);
+                channels[i]->queue->Dispatch(*channels[i]);
             }
         }
+        StartFrameGeneration();
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////
+    // Allocate an event payload from the frame arena
+    // The payload is valid until the end of the second DispatchQueuedEvents() from now, so
+    // the event that carries it must be queued before the next one. Events carry the returned
+    // accessor instead of a copy of the data. They can be called from any thread, every thread
+    // has its own arena
+    // Example: eventBus->QueueEvent<ChatEvent>(eventBus->CreatePayloadString(message))
+    /////////////////////////////////////////////////////////////////////////////////////////////////
+    template <typename T, typename... TArgs>
+    EventPayload<T> CreatePayload(TArgs &&...args)
+    {
+        return EventPayload<T>(AllocateFromFrameArena([&](FrameArena &frameArena)
+                                                      { return frameArena.Create<T>(std::forward<TArgs>(args)...); }));
+    }
+
+    // Array of numElements copies of T(args...)
+    template <typename T, typename... TArgs>
+    EventSpan<T> CreatePayloadArray(std::size_t numElements, const TArgs &...args)
+    {
+        T *elements = AllocateFromFrameArena([&](FrameArena &frameArena)
+                                             { return frameArena.CreateArray<T>(numElements, args...); });
+        return EventSpan<T>(elements, numElements);
     }
 
-    // Clears the subscriber list
+    // Copy of the text
+    std::string_view CreatePayloadString(std::string_view text)
+    {
+        char *characters = AllocateFromFrameArena([&](FrameArena &frameArena)
+                                                  { return frameArena.CreateArray<char>(text.size()); });
+        std::memcpy(characters, text.data(), text.size());
+        return std::string_view(characters, text.size());
+    }
+
+    // Removes all the subscriptions and queued events, the subscription handles become empty.
+    // It must not be called from a listener, or while other threads queue events
     void Reset()
     {
-        subscribers.clear();
+        for (auto &queueChannel : queueChannels)
+        {
+            queueChannel.store(nullptr, std::memory_order_relaxed);
+        }
+        channels.clear();
     }
 };
 
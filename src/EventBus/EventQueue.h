@@ -0,0 +1,332 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <tuple>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// EVENT QUEUE
+////////////////////////////////////////////////////////////////////////////////////////
+// Lock-free multi-producer, single-consumer queue of events of one type.
+// Every producer thread gets its own chain of slabs, so producers never write to the
+// same memory: pushing an event constructs it in the producer's current slab and
+// publishes it by bumping the slab's counter. The consumer (the main thread) drains
+// all the chains at a sync point, and gives the fully read slabs back to their
+// producers, so once warm the queue doesn't allocate.
+// The drained events are sorted by (sort key, producer, sequence). The producers are
+// numbered in the order their threads first pushed, which depends on the timing, so only
+// the sort key makes the order deterministic across runs: the tasks that queue events in
+// parallel must each use their own key (a loader index, the entity being processed).
+////////////////////////////////////////////////////////////////////////////////////////
+
+// Key of the events pushed from now on by the calling thread, to all the queues
+inline std::uint64_t &CurrentEventSortKey()
+{
+    static thread_local std::uint64_t sortKey = 0;
+    return sortKey;
+}
+
+// Sets the sort key of the calling thread until the end of the scope, then restores the
+// previous one, so the key never leaks into the next task the thread runs
+// Example: EventSortKeyScope sortKeyScope(entity.GetId());
+class EventSortKeyScope
+{
+private:
+    std::uint64_t previousSortKey;
+
+public:
+    explicit EventSortKeyScope(std::uint64_t sortKey) : previousSortKey(CurrentEventSortKey())
+    {
+        CurrentEventSortKey() = sortKey;
+    }
+    EventSortKeyScope(const EventSortKeyScope &) = delete;
+    EventSortKeyScope &operator=(const EventSortKeyScope &) = delete;
+    ~EventSortKeyScope()
+    {
+        CurrentEventSortKey() = previousSortKey;
+    }
+};
+
+template <typename TEvent>
+class EventQueue
+{
+private:
+    static const int SLAB_CAPACITY = 256;
+
+    struct Slab
+    {
+        alignas(TEvent) unsigned char events[SLAB_CAPACITY * sizeof(TEvent)];
+        std::uint64_t sortKeys[SLAB_CAPACITY];
+        // Number of published events, only written by the producer
+        std::atomic<int> numEvents{0};
+        // Next slab of the chain (or of the free list, while the slab is unused)
+        std::atomic<Slab *> next{nullptr};
+
+        TEvent *GetEvent(int index)
+        {
+            return std::launder(reinterpret_cast<TEvent *>(events) + index);
+        }
+    };
+
+    // Aligned to a cache line, so the producers don't slow each other down (false sharing)
+    struct alignas(64) Producer
+    {
+        std::thread::id threadId;
+        int producerIndex;
+        Producer *nextProducer = nullptr;
+
+        // Producer side: slab being filled and slabs ready to be reused
+        Slab *tail;
+        Slab *freeSlabs = nullptr;
+        // Consumer side: oldest slab with unread events, and how many of them were read
+        Slab *head;
+        int numReadEvents = 0;
+        // Slabs given back by the consumer, the producer takes all of them at once
+        std::atomic<Slab *> returnedSlabs{nullptr};
+    };
+
+    // Events of one slab read by a drain
+    struct DrainedRange
+    {
+        Slab *slab;
+        int begin;
+        int end;
+    };
+
+    struct DrainedEvent
+    {
+        std::uint64_t sortKey;
+        int index;
+        TEvent *event;
+    };
+
+    const int queueId;
+    std::atomic<Producer *> producers{nullptr};
+    std::atomic<int> numProducers{0};
+    // Consumer side, kept between the drains so they don't allocate
+    std::vector<Producer *> sortedProducers;
+    std::vector<DrainedRange> drainedRanges;
+    std::vector<DrainedEvent> drainedEvents;
+    std::vector<std::pair<Producer *, Slab *>> readSlabs;
+
+    static int NextQueueId()
+    {
+        static std::atomic<int> nextQueueId{0};
+        return nextQueueId++;
+    }
+
+    // Returns the producer of the calling thread, registering it the first time
+    Producer &GetProducer()
+    {
+        // Every thread caches the producer it got from the last queue it used
+        static thread_local int cachedQueueId = -1;
+        static thread_local Producer *cachedProducer = nullptr;
+        if (cachedQueueId == queueId)
+        {
+            return *cachedProducer;
+        }
+
+        const auto threadId = std::this_thread::get_id();
+        Producer *producer = producers.load(std::memory_order_acquire);
+        while (producer && producer->threadId != threadId)
+        {
+            producer = producer->nextProducer;
+        }
+        if (!producer)
+        {
+            producer = new Producer();
+            producer->threadId = threadId;
+            producer->producerIndex = numProducers++;
+            producer->tail = producer->head = new Slab();
+            producer->nextProducer = producers.load(std::memory_order_relaxed);
+            while (!producers.compare_exchange_weak(producer->nextProducer, producer, std::memory_order_release, std::memory_order_relaxed))
+            {
+            }
+        }
+        cachedQueueId = queueId;
+        cachedProducer = producer;
+        return *producer;
+    }
+
+    static Slab *AcquireSlab(Producer &producer)
+    {
+        if (!producer.freeSlabs)
+        {
+            producer.freeSlabs = producer.returnedSlabs.exchange(nullptr, std::memory_order_acquire);
+        }
+        Slab *slab = producer.freeSlabs;
+        if (!slab)
+        {
+            return new Slab();
+        }
+        producer.freeSlabs = slab->next.load(std::memory_order_relaxed);
+        slab->numEvents.store(0, std::memory_order_relaxed);
+        slab->next.store(nullptr, std::memory_order_relaxed);
+        return slab;
+    }
+
+    static void ReturnSlab(Producer &producer, Slab *slab)
+    {
+        Slab *returnedSlabs = producer.returnedSlabs.load(std::memory_order_relaxed);
+        do
+        {
+            slab->next.store(returnedSlabs, std::memory_order_relaxed);
+        } while (!producer.returnedSlabs.compare_exchange_weak(returnedSlabs, slab, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static void MoveEvent(TEvent *event, std::vector<TEvent> &events)
+    {
+        events.push_back(std::move(*event));
+        event->~TEvent();
+    }
+
+    static void DeleteSlabs(Slab *slab)
+    {
+        while (slab)
+        {
+            Slab *next = slab->next.load(std::memory_order_relaxed);
+            delete slab;
+            slab = next;
+        }
+    }
+
+public:
+    EventQueue() : queueId(NextQueueId()) {}
+    EventQueue(const EventQueue &) = delete;
+    EventQueue &operator=(const EventQueue &) = delete;
+
+    // The producers must be done pushing before the queue is destroyed
+    ~EventQueue()
+    {
+        Producer *producer = producers.load(std::memory_order_acquire);
+        while (producer)
+        {
+            for (Slab *slab = producer->head; slab; slab = slab->next.load(std::memory_order_acquire))
+            {
+                const int numEvents = slab->numEvents.load(std::memory_order_acquire);
+                for (int i = (slab == producer->head ? producer->numReadEvents : 0); i < numEvents; i++)
+                {
+                    slab->GetEvent(i)->~TEvent();
+                }
+            }
+            // The chain is deleted after the loop, it is linked through the same pointer
+            DeleteSlabs(producer->head);
+            DeleteSlabs(producer->freeSlabs);
+            DeleteSlabs(producer->returnedSlabs.load(std::memory_order_acquire));
+            Producer *nextProducer = producer->nextProducer;
+            delete producer;
+            producer = nextProducer;
+        }
+    }
+
+    // Can be called from any thread
+    template <typename... TArgs>
+    void Push(TArgs &&...args)
+    {
+        Producer &producer = GetProducer();
+        Slab *slab = producer.tail;
+        int numEvents = slab->numEvents.load(std::memory_order_relaxed);
+        if (numEvents == SLAB_CAPACITY)
+        {
+            Slab *newSlab = AcquireSlab(producer);
+            slab->next.store(newSlab, std::memory_order_release);
+            producer.tail = slab = newSlab;
+            numEvents = 0;
+        }
+        new (slab->GetEvent(numEvents)) TEvent(std::forward<TArgs>(args)...);
+        slab->sortKeys[numEvents] = CurrentEventSortKey();
+        slab->numEvents.store(numEvents + 1, std::memory_order_release);
+    }
+
+    // Moves the published events to the end of the vector, sorted by (sort key, producer, sequence).
+    // Only one thread (the consumer) can drain the queue
+    void Drain(std::vector<TEvent> &events)
+    {
+        // The producers are read in the order they registered, so the events are already sorted
+        // by (producer, sequence) and only need to be sorted when the threads set sort keys
+        sortedProducers.clear();
+        for (Producer *producer = producers.load(std::memory_order_acquire); producer; producer = producer->nextProducer)
+        {
+            sortedProducers.push_back(producer);
+        }
+        std::sort(sortedProducers.begin(), sortedProducers.end(), [](const Producer *a, const Producer *b)
+                  { return a->producerIndex < b->producerIndex; });
+
+        drainedRanges.clear();
+        readSlabs.clear();
+        bool isSorted = true;
+        std::uint64_t lastSortKey = 0;
+        for (Producer *producer : sortedProducers)
+        {
+            while (true)
+            {
+                Slab *slab = producer->head;
+                const int numEvents = slab->numEvents.load(std::memory_order_acquire);
+                if (producer->numReadEvents < numEvents)
+                {
+                    drainedRanges.push_back({slab, producer->numReadEvents, numEvents});
+                    for (int i = producer->numReadEvents; i < numEvents; i++)
+                    {
+                        isSorted &= slab->sortKeys[i] >= lastSortKey;
+                        lastSortKey = slab->sortKeys[i];
+                    }
+                }
+                producer->numReadEvents = numEvents;
+
+                // A full slab is done once the producer has moved on to the next one
+                Slab *next = numEvents == SLAB_CAPACITY ? slab->next.load(std::memory_order_acquire) : nullptr;
+                if (!next)
+                {
+                    break;
+                }
+                readSlabs.push_back({producer, slab});
+                producer->head = next;
+                producer->numReadEvents = 0;
+            }
+        }
+
+        if (isSorted)
+        {
+            for (const auto &range : drainedRanges)
+            {
+                for (int i = range.begin; i < range.end; i++)
+                {
+                    MoveEvent(range.slab->GetEvent(i), events);
+                }
+            }
+        }
+        else
+        {
+            drainedEvents.clear();
+            for (const auto &range : drainedRanges)
+            {
+                for (int i = range.begin; i < range.end; i++)
+                {
+                    drainedEvents.push_back({range.slab->sortKeys[i], static_cast<int>(drainedEvents.size()), range.slab->GetEvent(i)});
+                }
+            }
+            // The index in drainedEvents follows (producer, sequence), so it breaks the ties
+            std::sort(drainedEvents.begin(), drainedEvents.end(), [](const DrainedEvent &a, const DrainedEvent &b)
+                      { return std::tie(a.sortKey, a.index) < std::tie(b.sortKey, b.index); });
+            for (const auto &drainedEvent : drainedEvents)
+            {
+                MoveEvent(drainedEvent.event, events);
+            }
+        }
+
+        // The events are moved out, the slabs can be filled again
+        for (const auto &readSlab : readSlabs)
+        {
+            ReturnSlab(*readSlab.first, readSlab.second);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef EVENTTYPES_H
+#define EVENTTYPES_H
+
+// Defined in Event.h, the list only needs the names of the event types
+template <typename... TEvents>
+struct EventTypeList;
+
+class CollisionEvent;
+class KeyPressedEvent;
+
+// Event types with a compile-time id (their position in the list).
+// Types that are not listed still work, they get an id the first time they are used
+typedef EventTypeList<
+    CollisionEvent,
+    KeyPressedEvent>
+    RegisteredEventTypes;
+
+#endif
@@ -3,6 +3,7 @@
 #include <SDL2/SDL_image.h>
 #include <glm/glm.hpp>
 #include <fstream>
+#include <map>
 
 #include "Game.h"
 #include "../ECS/ECS.h"
@@ -28,6 +29,7 @@
 #include "../Systems/CameraMovementSystem.h"
 #include "../Systems/ProjectileEmitSystem.h"
 #include "../Systems/ProjectileLifecycleSystem.h"
+#include "../Systems/SpatialSortSystem.h"
 
 #include "../Events/KeyPressedEvent.h"
 
@@ -43,6 +45,7 @@ Game::Game()
     registry = std::make_unique<Registry>();
     assetStore = std::make_unique<AssetStore>();
     eventBus = std::make_unique<EventBus>();
+    threadPool = std::make_unique<ThreadPool>();
 }
 
 Game::~Game()
@@ -108,6 +111,10 @@ void Game::Run()
 
 void Game::Destroy()
 {
+    if (levelLoader.joinable())
+    {
+        levelLoader.join();
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -127,6 +134,31 @@ void Game::LoadLevel(int level)
     registry->AddSystem<CameraMovementSystem>();
     registry->AddSystem<ProjectileEmitSystem>();
     registry->AddSystem<ProjectileLifecycleSystem>();
+    registry->AddSystem<SpatialSortSystem>();
+
+    // The systems stay subscribed to their events for as long as they exist
+    registry->GetSystem<DamageSystem>().SubscribeToEvents(eventBus);
+    registry->GetSystem<KeyboardControlSystem>().SubscribeToEvents(eventBus);
+
+    // Components that are always iterated together are grouped, the first group to use a
+    // component owns its pool (MovementSystem owns the transforms, CollisionSystem the colliders)
+    registry->GetGroup<TransformComponent, RigidBodyComponent>();
+    registry->GetGroup<BoxColliderComponent, TransformComponent>();
+
+    // Schedule the systems that update every frame. Systems that don't access the same
+    // components run in parallel, the others run in the order they are scheduled here
+    registry->ScheduleSystem<MovementSystem>([this](MovementSystem &system)
+                                             { system.Update(registry, threadPool, deltaTime); });
+    registry->ScheduleSystem<AnimationSystem>([this](AnimationSystem &system)
+                                              { system.Update(threadPool); });
+    registry->ScheduleSystem<CollisionSystem>([this](CollisionSystem &system)
+                                              { system.Update(registry, eventBus); });
+    registry->ScheduleSystem<CameraMovementSystem>([this](CameraMovementSystem &system)
+                                                   { system.Update(registry, camera); });
+    registry->ScheduleSystem<ProjectileEmitSystem>([this](ProjectileEmitSystem &system)
+                                                   { system.Update(registry); });
+    registry->ScheduleSystem<ProjectileLifecycleSystem>([this](ProjectileLifecycleSystem &system)
+                                                        { system.Update(registry); });
 
     // Adding assets to the asset store
     assetStore->AddTexture(renderer, "tank-image", "./assets/images/tank-panther-right.png");
@@ -143,27 +175,55 @@ void Game::LoadLevel(int level)
     int mapNumCols = 25;
     int mapNumRows = 20;
 
-    std::fstream mapFile;
-    mapFile.open("./assets/tilemaps/jungle.map");
-
-    for (int y = 0; y < mapNumRows; y++)
+    // The tiles are built on the loader thread in a staging registry, which the next Registry.Update()
+    // merges into the game registry, so reading the map doesn't block the frames.
+    // The thread pool would not do: a thread waiting for its tasks runs any pending task,
+    // so the main thread could pick up the whole level build in the middle of a frame
+    if (levelLoader.joinable())
     {
-        for (int x = 0; x < mapNumCols; x++)
+        levelLoader.join();
+    }
+    levelLoader = std::thread([this, tileSize, tileScale, mapNumCols, mapNumRows]()
+                              {
+        auto tilemapRegistry = std::make_unique<Registry>();
+
+        std::fstream mapFile;
+        mapFile.open("./assets/tilemaps/jungle.map");
+
+        // Read all the tiles first, then create them in bulk.
+        // Tiles with the same source rectangle share a single sprite
+        std::map<std::pair<int, int>, Shared<SpriteComponent>> tileSpriteTypes;
+        std::vector<TransformComponent> tileTransforms;
+        std::vector<Shared<SpriteComponent>> tileSprites;
+        tileTransforms.reserve(mapNumRows * mapNumCols);
+        tileSprites.reserve(mapNumRows * mapNumCols);
+        for (int y = 0; y < mapNumRows; y++)
         {
-            char ch;
-            mapFile.get(ch);
-            int srcRectY = std::atoi(&ch) * tileSize;
-            mapFile.get(ch);
-            int srcRectX = std::atoi(&ch) * tileSize;
-            mapFile.ignore();
-
-            Entity tile = registry->CreateEntity();
-            tile.AddComponent<TransformComponent>(glm::vec2(x * (tileScale * tileSize), y * (tileScale * tileSize)), glm::vec2(tileScale, tileScale), 0.0);
-            tile.AddComponent<SpriteComponent>("jungle-tilemap", tileSize, tileSize, 0, false, srcRectX, srcRectY);
+            for (int x = 0; x < mapNumCols; x++)
+            {
+                char ch;
+                mapFile.get(ch);
+                int srcRectY = std::atoi(&ch) * tileSize;
+                mapFile.get(ch);
+                int srcRectX = std::atoi(&ch) * tileSize;
+                mapFile.ignore();
+
+                tileTransforms.emplace_back(glm::vec2(x * (tileScale * tileSize), y * (tileScale * tileSize)), glm::vec2(tileScale, tileScale), 0.0);
+                auto &tileSprite = tileSpriteTypes[{srcRectX, srcRectY}];
+                if (!tileSprite.IsValid())
+                {
+                    tileSprite = Shared<SpriteComponent>::Create("jungle-tilemap", tileSize, tileSize, 0, false, srcRectX, srcRectY);
+                }
+                tileSprites.push_back(tileSprite);
+            }
         }
-    }
 
-    mapFile.close();
+        mapFile.close();
+
+        std::vector<Entity> tiles = tilemapRegistry->CreateEntities(mapNumRows * mapNumCols);
+        tilemapRegistry->AddComponents<TransformComponent>(tiles, std::move(tileTransforms));
+        tilemapRegistry->AddComponents<Shared<SpriteComponent>>(tiles, std::move(tileSprites));
+        registry->Merge(std::move(tilemapRegistry)); });
 
     mapWidth = tileSize * tileScale * mapNumCols;
     mapHeight = tileSize * tileScale * mapNumRows;
@@ -178,21 +238,26 @@ void Game::LoadLevel(int level)
     chopper.AddComponent<CameraFollowComponent>();
     chopper.AddComponent<HealthComponent>(100);
 
-    Entity truck = registry->CreateEntity();
-    truck.AddComponent<TransformComponent>(glm::vec2(200.0, 10.0), glm::vec2(2.0, 2.0), 0.0);
-    truck.AddComponent<RigidBodyComponent>(glm::vec2(0.0, 0.0));
-    truck.AddComponent<SpriteComponent>("truck-image", 32, 32, 3);
-    truck.AddComponent<BoxColliderComponent>(32, 32);
-    truck.AddComponent<ProjectileEmitterComponent>(glm::vec2(0, 100), 2000, 5000, 0, false);
-    truck.AddComponent<HealthComponent>(100);
-
-    Entity tank = registry->CreateEntity();
-    tank.AddComponent<TransformComponent>(glm::vec2(10.0, 10.0), glm::vec2(2.0, 2.0), 0.0);
-    tank.AddComponent<RigidBodyComponent>(glm::vec2(0.0, 0.0));
-    tank.AddComponent<SpriteComponent>("tank-image", 32, 32, 2);
-    tank.AddComponent<BoxColliderComponent>(32, 32);
-    tank.AddComponent<ProjectileEmitterComponent>(glm::vec2(100, 0), 5000, 5000, 0, false);
-    tank.AddComponent<HealthComponent>(100);
+    // Enemy vehicles only differ by their position, sprite and projectile emitter
+    Prefab &vehiclePrefab = registry->RegisterPrefab("vehicle");
+    vehiclePrefab.AddComponent<RigidBodyComponent>(glm::vec2(0.0, 0.0));
+    vehiclePrefab.AddComponent<BoxColliderComponent>(32, 32);
+    vehiclePrefab.AddComponent<HealthComponent>(100);
+
+    registry->Instantiate(vehiclePrefab,
+                          TransformComponent(glm::vec2(200.0, 10.0), glm::vec2(2.0, 2.0), 0.0),
+                          SpriteComponent("truck-image", 32, 32, 3),
+                          ProjectileEmitterComponent(glm::vec2(0, 100), 2000, 5000, 0, false));
+
+    registry->Instantiate(vehiclePrefab,
+                          TransformComponent(glm::vec2(10.0, 10.0), glm::vec2(2.0, 2.0), 0.0),
+                          SpriteComponent("tank-image", 32, 32, 2),
+                          ProjectileEmitterComponent(glm::vec2(100, 0), 5000, 5000, 0, false));
+
+    // Projectiles get their transform, velocity and damage from the emitter, see ProjectileEmitSystem
+    Prefab &projectilePrefab = registry->RegisterPrefab("projectile");
+    projectilePrefab.AddComponent<Shared<SpriteComponent>>(Shared<SpriteComponent>::Create("bullet-image", 4, 4, 4));
+    projectilePrefab.AddComponent<BoxColliderComponent>(4, 4);
 
     Entity radar = registry->CreateEntity();
     radar.AddComponent<TransformComponent>(glm::vec2(windowWidth - 74.0, 10.0), glm::vec2(1.0, 1.0), 0.0);
@@ -223,6 +288,10 @@ void Game::ProcessInput()
             if (sdlEvent.key.keysym.sym == SDLK_d)
             {
                 isDebug = !isDebug;
+                if (isDebug)
+                {
+                    registry->LogStats();
+                }
             }
             eventBus->EmitEvent<KeyPressedEvent>(sdlEvent.key.keysym.sym);
             break;
@@ -242,28 +311,23 @@ void Game::Update()
     }
 
     // The difference in ticks since the last frame, converted to seconds
-    double deltaTime = (SDL_GetTicks() - millisecsPreviousFrame) / 1000.0;
+    deltaTime = (SDL_GetTicks() - millisecsPreviousFrame) / 1000.0;
 
     // Store the current frame time
     millisecsPreviousFrame = SDL_GetTicks();
 
-    // Reset all event handlers for the current frame
-    eventBus->Reset();
+    // Invoke all the systems that need to update, on the worker threads
+    registry->RunScheduledSystems(threadPool);
 
-    // Perform the subscription of the events for all systems
-    registry->GetSystem<DamageSystem>().SubscribeToEvents(eventBus);
-    registry->GetSystem<KeyboardControlSystem>().SubscribeToEvents(eventBus);
-
-    // Invoke all the systems that need to update
-    registry->GetSystem<MovementSystem>().Update(deltaTime);
-    registry->GetSystem<AnimationSystem>().Update();
-    registry->GetSystem<CollisionSystem>().Update(eventBus);
-    registry->GetSystem<CameraMovementSystem>().Update(camera);
-    registry->GetSystem<ProjectileEmitSystem>().Update(registry);
-    registry->GetSystem<ProjectileLifecycleSystem>().Update();
+    // Deliver the events queued by the systems, the listeners get them in one batch per type.
+    // It also releases the event payloads of the previous frame
+    eventBus->DispatchQueuedEvents();
 
     // Update the registry to process the entities that are waiting to be created/deleted
     registry->Update();
+
+    // Keep the entities that are close in the world close in memory, a few components per frame
+    registry->GetSystem<SpatialSortSystem>().Update(registry);
 }
 
 void Game::Render()
@@ -272,7 +336,7 @@ void Game::Render()
     SDL_RenderClear(renderer);
 
     // Invoke all the systems that need to render
-    registry->GetSystem<RenderSystem>().Update(renderer, assetStore, camera);
+    registry->GetSystem<RenderSystem>().Update(registry, renderer, assetStore, camera);
     if (isDebug)
     {
         registry->GetSystem<RenderCollisionSystem>().Update(renderer, camera);
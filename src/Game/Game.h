@@ -2,10 +2,12 @@
 #define GAME_H
 
 #include <SDL2/SDL.h>
+#include <thread>
 
 #include "../ECS/ECS.h"
 #include "../EventBus/EventBus.h"
 #include "../AssetStore/AssetStore.h"
+#include "../ThreadPool/ThreadPool.h"
 
 const int FPS = 60;
 const int MILLISECS_PER_FRAME = 1000 / FPS;
@@ -19,9 +21,13 @@ private:
     bool isRunning;
     bool isDebug;
     int millisecsPreviousFrame = 0;
+    double deltaTime = 0.0;
     std::unique_ptr<Registry> registry;
     std::unique_ptr<AssetStore> assetStore;
     std::unique_ptr<EventBus> eventBus;
+    std::unique_ptr<ThreadPool> threadPool;
+    // Builds the level in a staging registry, outside the thread pool so no frame ever runs it
+    std::thread levelLoader;
 
 public:
     Game();
@@ -1,3 +1,4 @@
 #include "./Logger.h"
 
 std::vector<LogEntry> Logger::logEntries;
+std::mutex Logger::logMutex;
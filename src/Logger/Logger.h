@@ -7,6 +7,7 @@
 #include <chrono>
 #include <ctime>
 #include <iostream>
+#include <mutex>
 #include <termcolor/termcolor.hpp>
 
 enum LogType
@@ -25,6 +26,9 @@ struct LogEntry
 class Logger
 {
 private:
+    // Systems may log from the worker threads, so the log entries are guarded by a mutex
+    static std::mutex logMutex;
+
     static std::string CurrentDateTimeToString()
     {
         std::time_t now_c = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -56,6 +60,7 @@ public:
 template <typename... Args>
 void Logger::Log(const Args &...args)
 {
+    std::lock_guard<std::mutex> lock(logMutex);
     LogEntry entry = {.type = LogType::INFO};
     entry.message = constructLogMessage("INFO", args...);
     std::cout << termcolor::green << entry.message << termcolor::reset << std::endl;
@@ -65,6 +70,7 @@ void Logger::Log(const Args &...args)
 template <typename... Args>
 void Logger::Warn(const Args &...args)
 {
+    std::lock_guard<std::mutex> lock(logMutex);
     LogEntry entry = {.type = LogType::WARNING};
     entry.message = constructLogMessage("WARNING", args...);
     std::cout << termcolor::yellow << entry.message << termcolor::reset << std::endl;
@@ -74,6 +80,7 @@ void Logger::Warn(const Args &...args)
 template <typename... Args>
 void Logger::Err(const Args &...args)
 {
+    std::lock_guard<std::mutex> lock(logMutex);
     LogEntry entry = {.type = LogType::ERROR};
     entry.message = constructLogMessage("ERROR", args...);
     std::cerr << termcolor::red << entry.message << termcolor::reset << std::endl;
@@ -0,0 +1,48 @@
+#include "./LinearArena.h"
+#include <algorithm>
+#include <cstdint>
+
+LinearArena::LinearArena(std::size_t blockSize) : blockSize(blockSize)
+{
+}
+
+void *LinearArena::Allocate(std::size_t size, std::size_t alignment)
+{
+    // Look for room in the current block, or in one of the blocks kept from before the last reset
+    while (currentBlock < blocks.size())
+    {
+        const auto base = reinterpret_cast<std::uintptr_t>(blocks[currentBlock].memory.get());
+        const auto address = (base + currentOffset + alignment - 1) / alignment * alignment;
+        if (address + size <= base + blocks[currentBlock].size)
+        {
+            currentOffset = address + size - base;
+            return reinterpret_cast<void *>(address);
+        }
+        currentBlock++;
+        currentOffset = 0;
+    }
+
+    // Allocate a new block, big enough for the requested size
+    std::size_t newBlockSize = std::max(blockSize, size + alignment);
+    const auto numElements = (newBlockSize + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    blocks.push_back({std::unique_ptr<std::max_align_t[]>(new std::max_align_t[numElements]), numElements * sizeof(std::max_align_t)});
+    currentBlock = blocks.size() - 1;
+    currentOffset = 0;
+    return Allocate(size, alignment);
+}
+
+void LinearArena::Reset()
+{
+    currentBlock = 0;
+    currentOffset = 0;
+}
+
+std::size_t LinearArena::GetCapacity() const
+{
+    std::size_t capacity = 0;
+    for (const auto &block : blocks)
+    {
+        capacity += block.size;
+    }
+    return capacity;
+}
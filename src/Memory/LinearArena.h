@@ -0,0 +1,51 @@
+#ifndef LINEARARENA_H
+#define LINEARARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// LINEAR ARENA
+////////////////////////////////////////////////////////////////////////////////////////
+// Allocates memory by bumping an offset inside big blocks, and releases everything
+// at once with Reset(). The blocks are kept after a reset, so once the arena has
+// grown to its steady-state size it never touches the global allocator again.
+// The arena doesn't call destructors, the owner of the objects is responsible for that.
+////////////////////////////////////////////////////////////////////////////////////////
+
+class LinearArena
+{
+private:
+    struct Block
+    {
+        std::unique_ptr<std::max_align_t[]> memory;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks;
+    std::size_t blockSize;
+    std::size_t currentBlock = 0;
+    std::size_t currentOffset = 0;
+
+public:
+    LinearArena(std::size_t blockSize = 64 * 1024);
+
+    void *Allocate(std::size_t size, std::size_t alignment);
+    template <typename T, typename... TArgs>
+    T *Create(TArgs &&...args);
+
+    // Makes all the memory available again, without freeing the blocks
+    void Reset();
+    std::size_t GetCapacity() const;
+};
+
+template <typename T, typename... TArgs>
+T *LinearArena::Create(TArgs &&...args)
+{
+    return new (Allocate(sizeof(T), alignof(T))) T(std::forward<TArgs>(args)...);
+}
+
+#endif
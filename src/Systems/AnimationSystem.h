@@ -13,20 +13,20 @@ class AnimationSystem : public System
 public:
     AnimationSystem()
     {
-        RequireComponent<AnimationComponent>();
-        RequireComponent<SpriteComponent>();
+        RequireComponent<Writes<AnimationComponent>>();
+        RequireComponent<Writes<SpriteComponent>>();
     }
 
-    void Update()
+    void Update(std::unique_ptr<ThreadPool> &threadPool)
     {
-        for (auto entity : GetSystemEntities())
-        {
+        const auto ticks = SDL_GetTicks();
+        ParallelEach(threadPool, [ticks](Entity entity)
+                     {
             auto &animation = entity.GetComponent<AnimationComponent>();
             auto &sprite = entity.GetComponent<SpriteComponent>();
 
-            animation.currentFrame = ((SDL_GetTicks() - animation.startTime) / (1000 / animation.frameSpeedRate)) % animation.numFrames;
-            sprite.srcRect.x = animation.currentFrame * sprite.width;
-        }
+            animation.currentFrame = ((ticks - animation.startTime) / (1000 / animation.frameSpeedRate)) % animation.numFrames;
+            sprite.srcRect.x = animation.currentFrame * sprite.width; });
     }
 };
 
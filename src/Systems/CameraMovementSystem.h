@@ -9,17 +9,25 @@
 
 class CameraMovementSystem : public System
 {
+private:
+    // Registry version of the last update, the camera only moves when the followed transform changed since then
+    std::uint32_t lastVersion = 0;
+
 public:
     CameraMovementSystem()
     {
-        RequireComponent<CameraFollowComponent>();
-        RequireComponent<TransformComponent>();
+        RequireComponent<Reads<CameraFollowComponent>>();
+        RequireComponent<Reads<TransformComponent>>();
     }
 
-    void Update(SDL_Rect &camera)
+    void Update(std::unique_ptr<Registry> &registry, SDL_Rect &camera)
     {
         for (auto entity : GetSystemEntities())
         {
+            if (registry->GetComponentVersion<TransformComponent>(entity) < lastVersion)
+            {
+                continue;
+            }
             auto transform = entity.GetComponent<TransformComponent>();
 
             SDL_Point entityPos = {transform.position.x,
@@ -36,6 +44,7 @@ public:
                 camera.y = entityPos.y - windowCenter.y;
             }
         }
+        lastVersion = registry->GetVersion();
     }
 };
 
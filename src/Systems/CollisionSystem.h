@@ -13,18 +13,29 @@ class CollisionSystem : public System
 public:
     CollisionSystem()
     {
-        RequireComponent<TransformComponent>();
-        RequireComponent<BoxColliderComponent>();
+        RequireComponent<Reads<TransformComponent>>();
+        RequireComponent<Writes<BoxColliderComponent>>();
     }
 
-    void Update(std::unique_ptr<EventBus> &eventBus)
+    void Update(std::unique_ptr<Registry> &registry, std::unique_ptr<EventBus> &eventBus)
     {
-        auto entities = GetSystemEntities();
+        struct CollidableEntity
+        {
+            Entity entity;
+            const TransformComponent *transform;
+            BoxColliderComponent *boxCollider;
+        };
+
+        // Resolve the components of all the collidable entities once, outside of the O(n^2) loop
+        std::vector<CollidableEntity> entities;
+        registry->GetGroup<BoxColliderComponent, TransformComponent>().each([&entities](Entity entity, auto &boxCollider, const auto &transform)
+                                                                            { entities.push_back({entity, &transform, &boxCollider}); });
+
         // Loop all the entites that the system is interested in
         for (auto a = entities.begin(); a != entities.end(); a++)
         {
-            auto &transformA = a->GetComponent<TransformComponent>();
-            auto &boxColliderA = a->GetComponent<BoxColliderComponent>();
+            const auto &transformA = *a->transform;
+            auto &boxColliderA = *a->boxCollider;
 
             boxColliderA.isColliding = false;
             // Loop all the entities that still need to be checked (to the right of a)
@@ -32,14 +43,15 @@ public:
             {
                 if (a != b)
                 {
-                    auto &transformB = b->GetComponent<TransformComponent>();
-                    auto &boxColliderB = b->GetComponent<BoxColliderComponent>();
+                    const auto &transformB = *b->transform;
+                    const auto &boxColliderB = *b->boxCollider;
 
                     // Perform AABB collision check between entites a and b
                     bool collisionHappened = CheckAABBCollision(transformA, boxColliderA, transformB, boxColliderB);
                     if (collisionHappened)
                     {
-                        eventBus->EmitEvent<CollisionEvent>(*a, *b);
+                        // Queued, the listeners process all the collisions after the systems are done
+                        eventBus->QueueEvent<CollisionEvent>(a->entity, b->entity);
                         if (!boxColliderA.isColliding)
                         {
                             boxColliderA.isColliding = true;
@@ -10,24 +10,31 @@
 class DamageSystem : public System
 {
 private:
-    void OnCollision(CollisionEvent &event)
+    EventSubscription collisionSubscription;
+
+    // Receives all the collisions of the frame in one batch, after the collision system is done
+    void OnCollisions(EventSpan<CollisionEvent> events)
     {
-        /*
-        event.a.Kill();
-        event.b.Kill();
-        */
-        Logger::Log("Damage system received a CollisionEvent between entities ", event.a.GetId(), " and ", event.b.GetId());
+        for (auto &event : events)
+        {
+            /*
+            event.a.Kill();
+            event.b.Kill();
+            */
+            Logger::Log("Damage system received a CollisionEvent between entities ", event.a.GetId(), " and ", event.b.GetId());
+        }
     }
 
 public:
     DamageSystem()
     {
-        RequireComponent<BoxColliderComponent>();
+        RequireComponent<Reads<BoxColliderComponent>>();
     }
 
+    // Subscribes once, the subscription is released with the system
     void SubscribeToEvents(std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<CollisionEvent>(this, &DamageSystem::OnCollision);
+        collisionSubscription = eventBus->SubscribeToEvent<&DamageSystem::OnCollisions>(this);
     }
 
     void Update()
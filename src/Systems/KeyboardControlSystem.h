@@ -13,6 +13,8 @@
 class KeyboardControlSystem : public System
 {
 private:
+    EventSubscription keyPressedSubscription;
+
     void OnKeyPressed(KeyPressedEvent &event)
     {
         for (auto entity : GetSystemEntities())
@@ -46,14 +48,15 @@ private:
 public:
     KeyboardControlSystem()
     {
-        RequireComponent<KeyboardControlledComponent>();
-        RequireComponent<SpriteComponent>();
-        RequireComponent<RigidBodyComponent>();
+        RequireComponent<Reads<KeyboardControlledComponent>>();
+        RequireComponent<Writes<SpriteComponent>>();
+        RequireComponent<Writes<RigidBodyComponent>>();
     }
 
+    // Subscribes once, the subscription is released with the system
     void SubscribeToEvents(std::unique_ptr<EventBus> &eventBus)
     {
-        eventBus->SubscribeToEvent<KeyPressedEvent>(this, &KeyboardControlSystem::OnKeyPressed);
+        keyPressedSubscription = eventBus->SubscribeToEvent<&KeyboardControlSystem::OnKeyPressed>(this);
     }
 
     void Update()
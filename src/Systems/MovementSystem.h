@@ -10,22 +10,26 @@ class MovementSystem : public System
 public:
     MovementSystem()
     {
-        RequireComponent<TransformComponent>();
-        RequireComponent<RigidBodyComponent>();
+        RequireComponent<Writes<TransformComponent>>();
+        RequireComponent<Reads<RigidBodyComponent>>();
     }
 
-    void Update(double deltaTime)
+    void Update(std::unique_ptr<Registry> &registry, std::unique_ptr<ThreadPool> &threadPool, double deltaTime)
     {
-        // Loop all entities that the system is interested in
-        for (auto entity : GetSystemEntities())
-        {
-            // Update entity position based on its velocity every frame of the game loop
-            auto &transform = entity.GetComponent<TransformComponent>();
-            const auto rigidBody = entity.GetComponent<RigidBodyComponent>();
+        // Loop all entities that have a transform and a rigid body, in parallel chunks.
+        // The group keeps both pools in the same order, so this walks them as plain arrays,
+        // and the moved transforms are flagged as changed by their index in the pool
+        registry->GetGroup<TransformComponent, RigidBodyComponent>().ParallelEachMarkChanged<TransformComponent>(threadPool, [deltaTime](auto &transform, const auto &rigidBody)
+                                                                                                                {
+            if (rigidBody.velocity.x == 0 && rigidBody.velocity.y == 0)
+            {
+                return false;
+            }
 
+            // Update entity position based on its velocity every frame of the game loop
             transform.position.x += rigidBody.velocity.x * deltaTime;
             transform.position.y += rigidBody.velocity.y * deltaTime;
-        }
+            return true; });
     }
 };
 
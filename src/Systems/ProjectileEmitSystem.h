@@ -15,12 +15,16 @@ class ProjectileEmitSystem : public System
 public:
     ProjectileEmitSystem()
     {
-        RequireComponent<ProjectileEmitterComponent>();
-        RequireComponent<TransformComponent>();
+        RequireComponent<Writes<ProjectileEmitterComponent>>();
+        RequireComponent<Reads<TransformComponent>>();
+        AccessComponent<Reads<SpriteComponent>>();
     }
 
     void Update(std::unique_ptr<Registry> &registry)
     {
+        // The projectiles are created through a command buffer, so this system can run next to the others
+        CommandBuffer &commandBuffer = registry->GetCommandBuffer();
+        const Prefab &projectilePrefab = registry->GetPrefab("projectile");
         for (auto entity : GetSystemEntities())
         {
             auto &projectileEmitter = entity.GetComponent<ProjectileEmitterComponent>();
@@ -37,13 +41,12 @@ public:
                     projectilePosition.y += sprite.height * transform.scale.y / 2;
                 }
 
-                // Add a new projectile entity to the registry
-                Entity projectile = registry->CreateEntity();
-                projectile.AddComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0);
-                projectile.AddComponent<RigidBodyComponent>(projectileEmitter.projectileVelocity);
-                projectile.AddComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-                projectile.AddComponent<BoxColliderComponent>(4, 4);
-                projectile.AddComponent<ProjectileComponent>(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.projectileDuration);
+                // Add a new projectile entity to the registry in the next Registry.Update()
+                commandBuffer.SetSortKey(entity.GetId());
+                commandBuffer.Instantiate(projectilePrefab,
+                                          TransformComponent(projectilePosition, glm::vec2(1.0, 1.0), 0),
+                                          RigidBodyComponent(projectileEmitter.projectileVelocity),
+                                          ProjectileComponent(projectileEmitter.isFriendly, projectileEmitter.hitPercentDamage, projectileEmitter.projectileDuration));
 
                 // Update the projectile emitter component last execution to the current milliseconds
                 projectileEmitter.lastEmissionTime = SDL_GetTicks();
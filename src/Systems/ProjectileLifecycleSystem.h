@@ -10,18 +10,21 @@ class ProjectileLifecycleSystem : public System
 public:
     ProjectileLifecycleSystem()
     {
-        RequireComponent<ProjectileComponent>();
+        RequireComponent<Reads<ProjectileComponent>>();
     }
 
-    void Update()
+    void Update(std::unique_ptr<Registry> &registry)
     {
+        // The expired projectiles are killed through a command buffer, so this system can run next to the others
+        CommandBuffer &commandBuffer = registry->GetCommandBuffer();
         for (auto entity : GetSystemEntities())
         {
 
             const auto &projectile = entity.GetComponent<ProjectileComponent>();
             if (SDL_GetTicks() - projectile.startTime >= projectile.duration)
             {
-                entity.Kill();
+                commandBuffer.SetSortKey(entity.GetId());
+                commandBuffer.KillEntity(entity);
             }
         }
     }
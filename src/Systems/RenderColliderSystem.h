@@ -13,8 +13,8 @@ class RenderCollisionSystem : public System
 public:
     RenderCollisionSystem()
     {
-        RequireComponent<TransformComponent>();
-        RequireComponent<BoxColliderComponent>();
+        RequireComponent<Reads<TransformComponent>>();
+        RequireComponent<Reads<BoxColliderComponent>>();
     }
 
     void Update(SDL_Renderer *renderer, SDL_Rect &camera)
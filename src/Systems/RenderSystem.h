@@ -14,22 +14,37 @@ class RenderSystem : public System
 public:
     RenderSystem()
     {
-        RequireComponent<SpriteComponent>();
-        RequireComponent<TransformComponent>();
+        // The renderable entities come from the views below, so the system keeps no entity list
+        AccessComponent<Reads<SpriteComponent>>();
+        AccessComponent<Reads<TransformComponent>>();
+        AccessComponent<Reads<Shared<SpriteComponent>>>();
     }
 
-    void Update(SDL_Renderer *renderer, std::unique_ptr<AssetStore> &assetStore, SDL_Rect &camera)
+    void Update(std::unique_ptr<Registry> &registry, SDL_Renderer *renderer, std::unique_ptr<AssetStore> &assetStore, SDL_Rect &camera)
     {
-        // Sort all the entities of our system by the z-index
-        std::vector<Entity> entities = GetSystemEntities();
-        std::sort(entities.begin(), entities.end(), [](const Entity &a, const Entity &b)
-                  { return a.GetComponent<SpriteComponent>().zIndex < b.GetComponent<SpriteComponent>().zIndex; });
-
-        // Loop all entities that the system is interested in
-        for (auto entity : entities)
+        struct RenderableEntity
+        {
+            const TransformComponent *transform;
+            const SpriteComponent *sprite;
+        };
+
+        // Collect the components of all the renderable entities once, so sorting doesn't need any lookups
+        std::vector<RenderableEntity> renderableEntities;
+        registry->View<TransformComponent, SpriteComponent>().each([&renderableEntities](const auto &transform, const auto &sprite)
+                                                                   { renderableEntities.push_back({&transform, &sprite}); });
+        // Entities with a shared sprite (e.g. tiles and projectiles) point to the shared instance
+        registry->View<TransformComponent, Shared<SpriteComponent>>().each([&renderableEntities](const auto &transform, const auto &sprite)
+                                                                           { renderableEntities.push_back({&transform, &sprite.Get()}); });
+
+        // Sort all the renderable entities by the z-index
+        std::sort(renderableEntities.begin(), renderableEntities.end(), [](const RenderableEntity &a, const RenderableEntity &b)
+                  { return a.sprite->zIndex < b.sprite->zIndex; });
+
+        // Loop all the renderable entities
+        for (const auto &renderableEntity : renderableEntities)
         {
-            const auto transform = entity.GetComponent<TransformComponent>();
-            const auto sprite = entity.GetComponent<SpriteComponent>();
+            const auto &transform = *renderableEntity.transform;
+            const auto &sprite = *renderableEntity.sprite;
 
             // Set the source rectangle of our original sprite texture
             SDL_Rect srcRect = sprite.srcRect;
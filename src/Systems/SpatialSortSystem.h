@@ -0,0 +1,84 @@
+#ifndef SPATIALSORTSYSTEM_H
+#define SPATIALSORTSYSTEM_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "../ECS/ECS.h"
+#include "../Components/TransformComponent.h"
+#include "../Components/BoxColliderComponent.h"
+#include "../Components/SpriteComponent.h"
+
+// Reorders the component storage by the Morton (Z-order) code of the entity positions, so entities
+// that are close in the world are also close in memory. The sort moves components, so it has to run
+// while no other system is iterating them (after Registry.Update())
+class SpatialSortSystem : public System
+{
+private:
+    // Size in pixels of the cells of the Morton grid
+    static constexpr double CELL_SIZE = 32.0;
+    // Components moved per pool and frame, so a pass is spread over several frames
+    static const int MAX_MOVES_PER_FRAME = 256;
+    // Frames to wait after a pass is complete, the entities don't move much in between
+    static const int FRAMES_BETWEEN_PASSES = 60;
+
+    int framesUntilNextPass = 0;
+
+    // Spreads the lower 16 bits of the value to the even bits
+    static std::uint32_t SpreadBits(std::uint32_t value)
+    {
+        value &= 0x0000FFFF;
+        value = (value | (value << 8)) & 0x00FF00FF;
+        value = (value | (value << 4)) & 0x0F0F0F0F;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    }
+
+    // Interleaves the bits of the cell coordinates, nearby cells get nearby codes
+    static std::uint64_t GetMortonCode(const glm::vec2 &position)
+    {
+        // Cell coordinates are offset so negative positions keep their order
+        auto toCell = [](double coordinate)
+        { return static_cast<std::uint32_t>(std::clamp(std::floor(coordinate / CELL_SIZE) + 32768.0, 0.0, 65535.0)); };
+        return SpreadBits(toCell(position.x)) | (SpreadBits(toCell(position.y)) << 1);
+    }
+
+public:
+    SpatialSortSystem()
+    {
+        RequireComponent<Reads<TransformComponent>>();
+    }
+
+    void Update(std::unique_ptr<Registry> &registry)
+    {
+        if (framesUntilNextPass > 0)
+        {
+            framesUntilNextPass--;
+            return;
+        }
+
+        // Entities without a transform go to the end of the pools
+        auto mortonCode = [](Entity entity) -> std::uint64_t
+        {
+            if (!entity.HasComponent<TransformComponent>())
+            {
+                return UINT64_MAX;
+            }
+            return GetMortonCode(entity.GetComponent<TransformComponent>().position);
+        };
+
+        // The components used by the neighbour-heavy systems (collision and rendering)
+        bool isPassComplete = registry->SortComponents<TransformComponent>(mortonCode, MAX_MOVES_PER_FRAME);
+        isPassComplete &= registry->SortComponents<BoxColliderComponent>(mortonCode, MAX_MOVES_PER_FRAME);
+        isPassComplete &= registry->SortComponents<SpriteComponent>(mortonCode, MAX_MOVES_PER_FRAME);
+        isPassComplete &= registry->SortComponents<Shared<SpriteComponent>>(mortonCode, MAX_MOVES_PER_FRAME);
+        if (isPassComplete)
+        {
+            framesUntilNextPass = FRAMES_BETWEEN_PASSES;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "./ThreadPool.h"
+#include "../Logger/Logger.h"
+
+// The worker threads remember which pool they belong to, and their queue in that pool
+static thread_local const ThreadPool *currentThreadPool = nullptr;
+static thread_local int currentWorkerIndex = -1;
+
+ThreadPool::ThreadPool(int numThreads)
+{
+    if (numThreads < 1)
+    {
+        numThreads = 1;
+    }
+    for (int i = 0; i < numThreads; i++)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 0; i < numThreads; i++)
+    {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+    Logger::Log("ThreadPool constructor called with ", numThreads, " worker threads");
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        isRunning = false;
+    }
+    sleepCondition.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    Logger::Log("ThreadPool destructor called");
+}
+
+int ThreadPool::GetNumThreads() const
+{
+    return workers.size();
+}
+
+int ThreadPool::GetCurrentWorkerIndex() const
+{
+    return currentThreadPool == this ? currentWorkerIndex : -1;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    // Workers push to their own queue, other threads spread the tasks over all the queues
+    int queueIndex = GetCurrentWorkerIndex();
+    if (queueIndex == -1)
+    {
+        queueIndex = nextQueue++ % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[queueIndex]->mutex);
+        queues[queueIndex]->tasks.push_back(std::move(task));
+    }
+    numPendingTasks++;
+
+    // Only wake a worker up if one is sleeping, the others will find the task on their own.
+    // Taking the sleep mutex makes sure a worker that is about to sleep sees the new task
+    if (numSleepingWorkers > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        sleepCondition.notify_one();
+    }
+}
+
+bool ThreadPool::RunPendingTask(int workerIndex)
+{
+    std::function<void()> task;
+
+    // Newest task from our own queue first
+    if (workerIndex != -1)
+    {
+        auto &queue = *queues[workerIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+    }
+
+    // Otherwise steal the oldest task from one of the other queues
+    const int numQueues = queues.size();
+    for (int i = 1; !task && i <= numQueues; i++)
+    {
+        const int victimIndex = (workerIndex + i + numQueues) % numQueues;
+        if (victimIndex == workerIndex)
+        {
+            continue;
+        }
+        auto &queue = *queues[victimIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+
+    if (!task)
+    {
+        return false;
+    }
+    numPendingTasks--;
+    task();
+    return true;
+}
+
+void ThreadPool::WaitForCounter(const std::atomic<int> &counter)
+{
+    const int workerIndex = GetCurrentWorkerIndex();
+    while (counter > 0)
+    {
+        if (!RunPendingTask(workerIndex))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(int workerIndex)
+{
+    currentThreadPool = this;
+    currentWorkerIndex = workerIndex;
+
+    while (true)
+    {
+        if (RunPendingTask(workerIndex))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        numSleepingWorkers++;
+        sleepCondition.wait(lock, [this]()
+                            { return !isRunning || numPendingTasks > 0; });
+        numSleepingWorkers--;
+        // Finish the pending tasks before shutting down
+        if (!isRunning && numPendingTasks == 0)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////////////
+// THREAD POOL
+////////////////////////////////////////////////////////////////////////////////////////
+// A fixed set of worker threads owned by the engine. Every worker has its own task
+// queue: it pops the newest task of its own queue (which is still warm in its cache),
+// and when it runs out of work it steals the oldest task from the other queues.
+// A thread that waits for a group of tasks keeps executing pending tasks meanwhile.
+////////////////////////////////////////////////////////////////////////////////////////
+
+class ThreadPool
+{
+private:
+    struct WorkerQueue
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues; // [Vector index = worker index]
+    std::atomic<int> numPendingTasks{0};
+    std::atomic<int> numSleepingWorkers{0};
+    std::atomic<unsigned int> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool isRunning = true;
+
+    // Index of the worker running on the current thread, or -1 if it isn't one of our workers
+    int GetCurrentWorkerIndex() const;
+    // Pops a task from the queue of the worker (or steals one), and runs it
+    bool RunPendingTask(int workerIndex);
+    void WorkerLoop(int workerIndex);
+
+public:
+    // By default we use one worker per core, the main thread takes the remaining core
+    ThreadPool(int numThreads = std::thread::hardware_concurrency() - 1);
+    ~ThreadPool();
+
+    int GetNumThreads() const;
+    void Enqueue(std::function<void()> task);
+    // Runs pending tasks on the calling thread until the counter drops to zero
+    void WaitForCounter(const std::atomic<int> &counter);
+
+    // Splits [0, numItems) in chunks of chunkSize items and calls func(begin, end) for every chunk
+    // on the workers and the calling thread, returns when all the chunks are done
+    template <typename TFunc>
+    void ParallelFor(int numItems, int chunkSize, TFunc func);
+};
+
+template <typename TFunc>
+void ThreadPool::ParallelFor(int numItems, int chunkSize, TFunc func)
+{
+    const int numChunks = (numItems + chunkSize - 1) / chunkSize;
+    if (numChunks <= 1)
+    {
+        func(0, numItems);
+        return;
+    }
+
+    // Every participating thread keeps grabbing the next chunk until there are none left,
+    // so the chunks are balanced across the threads without one task per chunk
+    struct ParallelForState
+    {
+        TFunc *func;
+        int numItems;
+        int chunkSize;
+        int numChunks;
+        std::atomic<int> nextChunk;
+        std::atomic<int> numRemainingTasks;
+
+        void RunChunks()
+        {
+            int chunkIndex;
+            while ((chunkIndex = nextChunk++) < numChunks)
+            {
+                const int begin = chunkIndex * chunkSize;
+                (*func)(begin, std::min(begin + chunkSize, numItems));
+            }
+        }
+    };
+    const int numTasks = std::min(numChunks - 1, GetNumThreads());
+    ParallelForState state = {&func, numItems, chunkSize, numChunks, {0}, {numTasks}};
+
+    // The tasks only capture a pointer to the shared state, so they fit in the small buffer of std::function
+    ParallelForState *statePointer = &state;
+    for (int i = 0; i < numTasks; i++)
+    {
+        Enqueue([statePointer]()
+                {
+            statePointer->RunChunks();
+            statePointer->numRemainingTasks--; });
+    }
+
+    // The calling thread works on the chunks too, and then helps until all the tasks are done
+    state.RunChunks();
+    WaitForCounter(state.numRemainingTasks);
+}
+
+#endif
@@ -0,0 +1,569 @@
+#include "../src/ECS/ECS.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <string>
+
+// Not a registered component type, it gets its id the first time it is used
+struct CountedComponent
+{
+    static int numMoves;
+    int value;
+
+    CountedComponent(int value = 0) : value(value) {}
+    CountedComponent(const CountedComponent &other) = default;
+    CountedComponent(CountedComponent &&other) : value(other.value) { numMoves++; }
+    CountedComponent &operator=(const CountedComponent &other) = default;
+    CountedComponent &operator=(CountedComponent &&other)
+    {
+        value = other.value;
+        numMoves++;
+        return *this;
+    }
+};
+int CountedComponent::numMoves = 0;
+
+// A component added after a kill recorded in the same buffer must not reach the registry
+void TestCommandBufferSkipsKilledEntities()
+{
+    Registry registry;
+    Entity entity = registry.CreateEntity();
+    registry.Update();
+
+    CommandBuffer &commandBuffer = registry.GetCommandBuffer();
+    commandBuffer.KillEntity(entity);
+    commandBuffer.AddComponent<CountedComponent>(entity, 42);
+    commandBuffer.RemoveComponent<CountedComponent>(entity);
+    CountedComponent::numMoves = 0;
+    registry.Update();
+
+    assert(CountedComponent::numMoves == 0);
+    assert(!registry.IsAlive(entity));
+}
+
+// A thread switching between registries keeps one command buffer in each of them
+void TestCommandBufferIsReusedAcrossRegistries()
+{
+    Registry registryA;
+    Registry registryB;
+    CommandBuffer *commandBufferA = &registryA.GetCommandBuffer();
+    CommandBuffer *commandBufferB = &registryB.GetCommandBuffer();
+    for (int i = 0; i < 100; i++)
+    {
+        assert(&registryA.GetCommandBuffer() == commandBufferA);
+        assert(&registryB.GetCommandBuffer() == commandBufferB);
+    }
+}
+
+struct CounterComponent
+{
+    int value = 0;
+};
+
+// Three systems writing the same component, so each one depends on the ones scheduled before it
+template <int Index>
+class CounterSystem : public System
+{
+public:
+    CounterSystem()
+    {
+        RequireComponent<Writes<CounterComponent>>();
+    }
+};
+
+// Removing a scheduled system must drop its update, and keep the others running in order
+void TestRemoveScheduledSystem()
+{
+    auto threadPool = std::make_unique<ThreadPool>(2);
+    Registry registry;
+    registry.AddSystem<CounterSystem<0>>();
+    registry.AddSystem<CounterSystem<1>>();
+    registry.AddSystem<CounterSystem<2>>();
+    std::vector<int> updateOrder;
+    registry.ScheduleSystem<CounterSystem<0>>([&updateOrder](CounterSystem<0> &)
+                                              { updateOrder.push_back(0); });
+    registry.ScheduleSystem<CounterSystem<1>>([&updateOrder](CounterSystem<1> &)
+                                              { updateOrder.push_back(1); });
+    registry.ScheduleSystem<CounterSystem<2>>([&updateOrder](CounterSystem<2> &)
+                                              { updateOrder.push_back(2); });
+
+    registry.RemoveSystem<CounterSystem<1>>();
+    registry.RunScheduledSystems(threadPool);
+    assert((updateOrder == std::vector<int>{0, 2}));
+
+    registry.RemoveSystem<CounterSystem<0>>();
+    updateOrder.clear();
+    registry.RunScheduledSystems(threadPool);
+    assert((updateOrder == std::vector<int>{2}));
+}
+
+struct PositionComponent
+{
+    int x = 0;
+};
+
+struct VelocityComponent
+{
+    int dx = 0;
+};
+
+// Tag component, it only lives in the entity signatures
+struct MergedTagComponent
+{
+};
+
+class MovingSystem : public System
+{
+public:
+    MovingSystem()
+    {
+        RequireComponent<PositionComponent>();
+        RequireComponent<VelocityComponent>();
+    }
+};
+
+class MergedTagSystem : public System
+{
+public:
+    MergedTagSystem()
+    {
+        RequireComponent<MergedTagComponent>();
+    }
+};
+
+// Merging gives the staging entities new ids after the live ones, keeps their components and tags,
+// packs them in the owning group and registers them with the systems
+void TestMergeRegistry()
+{
+    Registry registry;
+    registry.AddSystem<MovingSystem>();
+    registry.AddSystem<MergedTagSystem>();
+    Entity existing = registry.CreateEntity();
+    registry.AddComponent<PositionComponent>(existing, PositionComponent{1});
+    registry.AddComponent<VelocityComponent>(existing, VelocityComponent{1});
+    registry.Update();
+    auto &group = registry.GetGroup<PositionComponent, VelocityComponent>();
+    assert(group.IsOwning() && group.GetSize() == 1);
+
+    // Staging entities 0, 2 and 3 are alive, id 1 was freed, so the ids can't be copied as they are
+    auto stagingRegistry = std::make_unique<Registry>();
+    std::vector<Entity> stagingEntities = stagingRegistry->CreateEntities(4);
+    for (int i = 0; i < 4; i++)
+    {
+        stagingRegistry->AddComponent<PositionComponent>(stagingEntities[i], PositionComponent{100 + i});
+    }
+    stagingRegistry->AddComponent<VelocityComponent>(stagingEntities[0], VelocityComponent{10});
+    stagingRegistry->AddComponent<VelocityComponent>(stagingEntities[3], VelocityComponent{13});
+    stagingRegistry->AddComponent<MergedTagComponent>(stagingEntities[2]);
+    stagingRegistry->KillEntity(stagingEntities[1]);
+    stagingRegistry->Update();
+
+    registry.Merge(std::move(stagingRegistry));
+    registry.Update();
+
+    std::vector<int> mergedIds;
+    registry.View<PositionComponent>().each([&](Entity entity, PositionComponent &position)
+                                            {
+        if (position.x >= 100)
+        {
+            mergedIds.push_back(entity.GetId());
+        } });
+    assert(mergedIds.size() == 3);
+    for (auto mergedId : mergedIds)
+    {
+        Entity entity = registry.GetEntityById(mergedId);
+        assert(registry.IsAlive(entity) && mergedId != existing.GetId());
+        const int stagingIndex = registry.GetComponent<PositionComponent>(entity).x - 100;
+        assert(stagingIndex != 1);
+        assert(registry.HasComponent<VelocityComponent>(entity) == (stagingIndex == 0 || stagingIndex == 3));
+        if (registry.HasComponent<VelocityComponent>(entity))
+        {
+            assert(registry.GetComponent<VelocityComponent>(entity).dx == 10 + stagingIndex);
+        }
+        assert(registry.HasComponent<MergedTagComponent>(entity) == (stagingIndex == 2));
+    }
+
+    // The group walks its owned pools in lockstep, so the packed components must belong to the same entities
+    assert(group.GetSize() == 3);
+    group.each([](PositionComponent &position, VelocityComponent &velocity)
+               { assert(position.x % 100 == velocity.dx % 10); });
+
+    assert(registry.GetSystem<MovingSystem>().GetSystemEntities().size() == 3);
+    const auto &taggedEntities = registry.GetSystem<MergedTagSystem>().GetSystemEntities();
+    assert(taggedEntities.size() == 1 && registry.GetComponent<PositionComponent>(taggedEntities[0]).x == 102);
+}
+
+// Only declares what it reads, like a system that iterates views
+class ViewOnlySystem : public System
+{
+public:
+    ViewOnlySystem()
+    {
+        AccessComponent<Reads<PositionComponent>>();
+    }
+};
+
+// A system that requires no component must not collect every entity of the registry
+void TestSystemWithoutRequiredComponents()
+{
+    Registry registry;
+    registry.AddSystem<ViewOnlySystem>();
+    Entity created = registry.CreateEntity();
+    registry.AddComponent<PositionComponent>(created, PositionComponent{1});
+    registry.CreateEntity();
+    registry.Update();
+    Entity existing = registry.CreateEntity();
+    registry.Update();
+    registry.AddComponent<PositionComponent>(existing, PositionComponent{2});
+    registry.Update();
+    assert(registry.GetSystem<ViewOnlySystem>().GetSystemEntities().empty());
+}
+
+// Every component remembers its entity, so a group handing out mismatched components is caught
+template <int Index>
+struct EntityIdComponent
+{
+    int entityId = -1;
+};
+typedef EntityIdComponent<0> BodyComponent;
+typedef EntityIdComponent<1> SpeedComponent;
+typedef EntityIdComponent<2> ShapeComponent;
+
+// Entities of the group, checking that every component it hands out belongs to the entity
+template <typename... TComponents>
+std::vector<int> GetGroupEntityIds(Group<TComponents...> &group)
+{
+    std::vector<int> entityIds;
+    group.each([&entityIds](Entity entity, TComponents &...components)
+               {
+        assert(((components.entityId == entity.GetId()) && ...));
+        entityIds.push_back(entity.GetId()); });
+    std::sort(entityIds.begin(), entityIds.end());
+    return entityIds;
+}
+
+// The first entities of the pool, which an owning group keeps packed
+template <typename TComponent>
+std::vector<int> GetPackedEntityIds(Registry &registry, int size)
+{
+    const auto &entityIds = registry.GetComponentPool<TComponent>()->GetEntityIds();
+    std::vector<int> packedEntityIds(entityIds.begin(), entityIds.begin() + size);
+    std::sort(packedEntityIds.begin(), packedEntityIds.end());
+    return packedEntityIds;
+}
+
+// The <Body, Speed> group owns both pools, the <Shape, Body> group created after it only owns the shapes.
+// Removing a component the group doesn't own, or killing an entity in the middle of the packed range,
+// must take the entity out of the packed range of every owned pool
+void TestOwningGroups()
+{
+    Registry registry;
+    auto &movingGroup = registry.GetGroup<BodyComponent, SpeedComponent>();
+    // Entities 0 to 5 have a body, the even ones a speed, and all but 5 a shape
+    std::vector<Entity> entities = registry.CreateEntities(6);
+    for (auto entity : entities)
+    {
+        const int entityId = entity.GetId();
+        registry.AddComponent<BodyComponent>(entity, BodyComponent{entityId});
+        if (entityId % 2 == 0)
+        {
+            registry.AddComponent<SpeedComponent>(entity, SpeedComponent{entityId});
+        }
+        if (entityId != 5)
+        {
+            registry.AddComponent<ShapeComponent>(entity, ShapeComponent{entityId});
+        }
+    }
+    registry.Update();
+    // Created after the components, so it packs the existing entities
+    auto &shapeGroup = registry.GetGroup<ShapeComponent, BodyComponent>();
+
+    assert(movingGroup.IsOwning() && shapeGroup.IsOwning());
+    assert((GetGroupEntityIds(movingGroup) == std::vector<int>{0, 2, 4}));
+    assert((GetGroupEntityIds(shapeGroup) == std::vector<int>{0, 1, 2, 3, 4}));
+    assert((GetPackedEntityIds<BodyComponent>(registry, 3) == std::vector<int>{0, 2, 4}));
+    assert((GetPackedEntityIds<SpeedComponent>(registry, 3) == std::vector<int>{0, 2, 4}));
+    assert((GetPackedEntityIds<ShapeComponent>(registry, 5) == std::vector<int>{0, 1, 2, 3, 4}));
+
+    // The shape group doesn't own the bodies, but losing the body still takes the entity out of it
+    registry.RemoveComponent<BodyComponent>(entities[2]);
+    assert((GetGroupEntityIds(movingGroup) == std::vector<int>{0, 4}));
+    assert((GetGroupEntityIds(shapeGroup) == std::vector<int>{0, 1, 3, 4}));
+    assert((GetPackedEntityIds<BodyComponent>(registry, 2) == std::vector<int>{0, 4}));
+    assert((GetPackedEntityIds<SpeedComponent>(registry, 2) == std::vector<int>{0, 4}));
+    assert((GetPackedEntityIds<ShapeComponent>(registry, 4) == std::vector<int>{0, 1, 3, 4}));
+
+    // Entity 1 sits in the middle of the packed shapes
+    registry.KillEntity(entities[1]);
+    registry.Update();
+    assert((GetGroupEntityIds(movingGroup) == std::vector<int>{0, 4}));
+    assert((GetGroupEntityIds(shapeGroup) == std::vector<int>{0, 3, 4}));
+    assert((GetPackedEntityIds<ShapeComponent>(registry, 3) == std::vector<int>{0, 3, 4}));
+
+    // Getting the body back puts entity 2 back in both groups
+    registry.AddComponent<BodyComponent>(entities[2], BodyComponent{2});
+    assert((GetGroupEntityIds(movingGroup) == std::vector<int>{0, 2, 4}));
+    assert((GetGroupEntityIds(shapeGroup) == std::vector<int>{0, 2, 3, 4}));
+}
+
+// Scrambled sort key of an entity
+std::uint64_t GetScrambledKey(Entity entity)
+{
+    return (entity.GetId() * 7919) % 101;
+}
+
+// The group members are packed in front of both owned pools, in the same order, and the components match the entities
+void CheckMovingGroupPacking(Registry &registry, Group<BodyComponent, SpeedComponent> &group)
+{
+    GetGroupEntityIds(group);
+    const auto &bodyEntityIds = registry.GetComponentPool<BodyComponent>()->GetEntityIds();
+    const auto &speedEntityIds = registry.GetComponentPool<SpeedComponent>()->GetEntityIds();
+    for (int i = 0; i < group.GetSize(); i++)
+    {
+        assert(bodyEntityIds[i] == speedEntityIds[i]);
+    }
+}
+
+// Sorting the bodies, whose pool the group owns, moves the speeds along and keeps the group members in front,
+// each part sorted by key
+void TestSortComponentsOfGroup()
+{
+    Registry registry;
+    auto &group = registry.GetGroup<BodyComponent, SpeedComponent>();
+    for (auto entity : registry.CreateEntities(200))
+    {
+        registry.AddComponent<BodyComponent>(entity, BodyComponent{entity.GetId()});
+        if (entity.GetId() % 3 != 0)
+        {
+            registry.AddComponent<SpeedComponent>(entity, SpeedComponent{entity.GetId()});
+        }
+    }
+    registry.Update();
+
+    assert(registry.SortComponents<BodyComponent>(GetScrambledKey, 1000));
+    CheckMovingGroupPacking(registry, group);
+    const auto &bodyEntityIds = registry.GetComponentPool<BodyComponent>()->GetEntityIds();
+    for (int i = 1; i < static_cast<int>(bodyEntityIds.size()); i++)
+    {
+        if (i != group.GetSize())
+        {
+            assert(GetScrambledKey(Entity(bodyEntityIds[i - 1])) <= GetScrambledKey(Entity(bodyEntityIds[i])));
+        }
+    }
+}
+
+// A pass of a few moves per frame keeps running while entities join and leave the group, are killed and created
+void TestIncrementalSortAcrossFrames()
+{
+    Registry registry;
+    auto &group = registry.GetGroup<BodyComponent, SpeedComponent>();
+    std::vector<Entity> entities;
+    for (auto entity : registry.CreateEntities(100))
+    {
+        registry.AddComponent<BodyComponent>(entity, BodyComponent{entity.GetId()});
+        entities.push_back(entity);
+    }
+    registry.Update();
+
+    bool isDone = false;
+    for (int frame = 0; frame < 20; frame++)
+    {
+        isDone = registry.SortComponents<BodyComponent>(GetScrambledKey, 4);
+        // Entities join the group, leave it, die and are born while the pass is underway
+        Entity joining = entities[(frame * 13) % entities.size()];
+        if (registry.IsAlive(joining) && !registry.HasComponent<SpeedComponent>(joining))
+        {
+            registry.AddComponent<SpeedComponent>(joining, SpeedComponent{joining.GetId()});
+        }
+        Entity leaving = entities[(frame * 29 + 7) % entities.size()];
+        if (registry.IsAlive(leaving) && registry.HasComponent<SpeedComponent>(leaving))
+        {
+            registry.RemoveComponent<SpeedComponent>(leaving);
+        }
+        registry.KillEntity(entities[(frame * 17 + 3) % entities.size()]);
+        Entity born = registry.CreateEntity();
+        registry.AddComponent<BodyComponent>(born, BodyComponent{born.GetId()});
+        registry.AddComponent<SpeedComponent>(born, SpeedComponent{born.GetId()});
+        entities.push_back(born);
+        registry.Update();
+        CheckMovingGroupPacking(registry, group);
+    }
+    assert(!isDone);
+
+    // Once the entities stop changing, the passes finish and leave the pool sorted
+    while (!registry.SortComponents<BodyComponent>(GetScrambledKey, 4))
+    {
+        CheckMovingGroupPacking(registry, group);
+    }
+    assert(registry.SortComponents<BodyComponent>(GetScrambledKey, 1000));
+    CheckMovingGroupPacking(registry, group);
+    const auto &bodyEntityIds = registry.GetComponentPool<BodyComponent>()->GetEntityIds();
+    for (int i = 1; i < static_cast<int>(bodyEntityIds.size()); i++)
+    {
+        if (i != group.GetSize())
+        {
+            assert(GetScrambledKey(Entity(bodyEntityIds[i - 1])) <= GetScrambledKey(Entity(bodyEntityIds[i])));
+        }
+    }
+}
+
+// Only the components func reports as changed get the current version, through the dense index of an owned
+// pool and through the entity lookup of a pool the group doesn't own. Enough entities to run in parallel
+void TestParallelEachMarkChanged()
+{
+    const int numEntities = PARALLEL_EACH_MIN_ENTITIES + PARALLEL_EACH_CHUNK_SIZE;
+    auto threadPool = std::make_unique<ThreadPool>(2);
+    Registry registry;
+    auto &ownedGroup = registry.GetGroup<BodyComponent, SpeedComponent>();
+    auto &partialGroup = registry.GetGroup<ShapeComponent, BodyComponent>();
+    std::vector<Entity> entities = registry.CreateEntities(numEntities);
+    for (auto entity : entities)
+    {
+        registry.AddComponent<BodyComponent>(entity, BodyComponent{entity.GetId()});
+        registry.AddComponent<SpeedComponent>(entity, SpeedComponent{entity.GetId()});
+        registry.AddComponent<ShapeComponent>(entity, ShapeComponent{entity.GetId()});
+    }
+    registry.Update();
+
+    const std::uint32_t sinceVersion = registry.GetVersion();
+    ownedGroup.ParallelEachMarkChanged<SpeedComponent>(threadPool, [](BodyComponent &body, SpeedComponent &speed)
+                                                       { return speed.entityId % 3 == 0; });
+    partialGroup.ParallelEachMarkChanged<BodyComponent>(threadPool, [](Entity entity, ShapeComponent &shape, BodyComponent &body)
+                                                        { return entity.GetId() % 5 == 0; });
+
+    int numChangedSpeeds = 0;
+    registry.Changed<SpeedComponent>(sinceVersion).each([&numChangedSpeeds](Entity entity, SpeedComponent &speed)
+                                                        {
+        assert(entity.GetId() % 3 == 0 && speed.entityId == entity.GetId());
+        numChangedSpeeds++; });
+    assert(numChangedSpeeds == (numEntities + 2) / 3);
+    int numChangedBodies = 0;
+    registry.Changed<BodyComponent>(sinceVersion).each([&numChangedBodies](Entity entity, BodyComponent &body)
+                                                       {
+        assert(entity.GetId() % 5 == 0 && body.entityId == entity.GetId());
+        numChangedBodies++; });
+    assert(numChangedBodies == (numEntities + 4) / 5);
+}
+
+// Too long for the small string buffer, so a component relocated with memcpy or never destroyed shows up under ASan
+struct LabelComponent
+{
+    std::string text;
+};
+
+struct ArchetypeTagComponent
+{
+};
+
+std::string GetLabel(int index)
+{
+    return "archetype test entity number " + std::to_string(index);
+}
+
+// Checks every entity against the components it was given, index = entity id
+void CheckArchetypeEntities(Registry &registry, const std::vector<Entity> &entities)
+{
+    int numLabels = 0;
+    for (int i = 0; i < static_cast<int>(entities.size()); i++)
+    {
+        Entity entity = entities[i];
+        if (!registry.IsAlive(entity))
+        {
+            continue;
+        }
+        numLabels++;
+        assert(registry.GetComponent<LabelComponent>(entity).text == GetLabel(i));
+        assert(registry.HasComponent<PositionComponent>(entity) == (i % 5 != 0));
+        if (registry.HasComponent<PositionComponent>(entity))
+        {
+            assert(registry.GetComponent<PositionComponent>(entity).x == i);
+        }
+        assert(registry.HasComponent<VelocityComponent>(entity) == (i % 2 == 0));
+        if (registry.HasComponent<VelocityComponent>(entity))
+        {
+            assert(registry.GetComponent<VelocityComponent>(entity).dx == i);
+        }
+        assert(registry.HasComponent<ArchetypeTagComponent>(entity) == (i % 3 == 0));
+    }
+
+    int numViewed = 0;
+    registry.View<LabelComponent>().each([&](Entity entity, LabelComponent &label)
+                                         {
+        assert(label.text == GetLabel(entity.GetId()));
+        numViewed++; });
+    assert(numViewed == numLabels);
+    registry.View<PositionComponent, VelocityComponent>().each([](Entity entity, PositionComponent &position, VelocityComponent &velocity)
+                                                               { assert(position.x == entity.GetId() && velocity.dx == entity.GetId()); });
+}
+
+// Adding and removing components moves the entities between archetypes, and killing them in the
+// middle of a chunk moves the last row into the hole. The entities span several chunks of every archetype
+void TestArchetypeStorage()
+{
+    const int numEntities = 1000;
+    Registry registry(StorageMode::Archetypes);
+    std::vector<Entity> entities = registry.CreateEntities(numEntities);
+    for (int i = 0; i < numEntities; i++)
+    {
+        registry.AddComponent<LabelComponent>(entities[i], LabelComponent{GetLabel(i)});
+        registry.AddComponent<PositionComponent>(entities[i], PositionComponent{i});
+    }
+    registry.Update();
+    assert(registry.GetStats().numArchetypes == 2 && registry.GetStats().numChunks > 1);
+
+    for (int i = 0; i < numEntities; i++)
+    {
+        if (i % 2 == 0)
+        {
+            registry.AddComponent<VelocityComponent>(entities[i], VelocityComponent{i});
+        }
+        if (i % 3 == 0)
+        {
+            registry.AddComponent<ArchetypeTagComponent>(entities[i]);
+        }
+        if (i % 5 == 0)
+        {
+            registry.RemoveComponent<PositionComponent>(entities[i]);
+        }
+    }
+    registry.Update();
+    CheckArchetypeEntities(registry, entities);
+
+    for (int i = 0; i < numEntities; i++)
+    {
+        if (i % 7 == 3)
+        {
+            registry.KillEntity(entities[i]);
+        }
+    }
+    registry.Update();
+    CheckArchetypeEntities(registry, entities);
+
+    // Empty chunks are freed, the archetypes themselves are kept for the next entities with their signature
+    const int numArchetypes = registry.GetStats().numArchetypes;
+    for (int i = 0; i < numEntities; i++)
+    {
+        if (registry.IsAlive(entities[i]))
+        {
+            registry.KillEntity(entities[i]);
+        }
+    }
+    registry.Update();
+    assert(registry.GetStats().numChunks == 0 && registry.GetStats().numArchetypes == numArchetypes);
+}
+
+int main()
+{
+    TestCommandBufferSkipsKilledEntities();
+    TestCommandBufferIsReusedAcrossRegistries();
+    TestRemoveScheduledSystem();
+    TestMergeRegistry();
+    TestSystemWithoutRequiredComponents();
+    TestOwningGroups();
+    TestSortComponentsOfGroup();
+    TestIncrementalSortAcrossFrames();
+    TestParallelEachMarkChanged();
+    TestArchetypeStorage();
+    std::cout << "ECSTest passed" << std::endl;
+    return 0;
+}
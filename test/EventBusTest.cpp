@@ -0,0 +1,117 @@
+#include "../src/EventBus/EventBus.h"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Not registered event types, they get their id the first time they are used
+class RequestEvent : public Event
+{
+public:
+    int requestId;
+    RequestEvent(int requestId) : requestId(requestId) {}
+};
+
+class ReplyEvent : public Event
+{
+public:
+    int requestId;
+    EventPayload<std::string> text;
+    ReplyEvent(int requestId, EventPayload<std::string> text) : requestId(requestId), text(text) {}
+};
+
+std::string GetReplyText(int requestId)
+{
+    // Longer than the small string buffer, so the text lives in its own allocation
+    return "reply to request " + std::to_string(requestId) + std::string(64, '.');
+}
+
+class Server
+{
+public:
+    EventBus *eventBus;
+    EventSubscription requestSubscription;
+
+    void OnRequest(RequestEvent &event)
+    {
+        eventBus->QueueEvent<ReplyEvent>(event.requestId, eventBus->CreatePayload<std::string>(GetReplyText(event.requestId)));
+    }
+};
+
+class Client
+{
+public:
+    int numReplies = 0;
+    EventSubscription replySubscription;
+
+    void OnReply(ReplyEvent &event)
+    {
+        assert(*event.text == GetReplyText(event.requestId));
+        numReplies++;
+    }
+};
+
+// A payload queued from a listener must survive until the next frame delivers its event
+void TestPayloadQueuedFromListener()
+{
+    EventBus eventBus;
+    Server server{&eventBus};
+    Client client;
+    // The reply channel comes first, so the replies queued by OnRequest wait for the next frame
+    client.replySubscription = eventBus.SubscribeToEvent<&Client::OnReply>(&client);
+    server.requestSubscription = eventBus.SubscribeToEvent<&Server::OnRequest>(&server);
+
+    const int numFrames = 8;
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+        eventBus.QueueEvent<RequestEvent>(frame);
+        eventBus.DispatchQueuedEvents();
+        assert(client.numReplies == frame);
+        // Payloads created after the drain must not overwrite the ones still queued
+        eventBus.CreatePayloadString(std::string(256, 'x'));
+        eventBus.CreatePayloadArray<int>(64, -1);
+    }
+    eventBus.DispatchQueuedEvents();
+    assert(client.numReplies == numFrames);
+}
+
+// A producer thread creates payloads while the main thread keeps dispatching, and resetting the arenas.
+// The producer queues every payload before the main thread dispatches twice
+void TestPayloadsFromAnotherThread()
+{
+    EventBus eventBus;
+    Client client;
+    client.replySubscription = eventBus.SubscribeToEvent<&Client::OnReply>(&client);
+
+    const int numEvents = 2000;
+    std::atomic<int> numQueuedEvents{0};
+    std::thread producer([&eventBus, &numQueuedEvents]()
+                         {
+        for (int requestId = 0; requestId < numEvents; requestId++)
+        {
+            eventBus.QueueEvent<ReplyEvent>(requestId, eventBus.CreatePayload<std::string>(GetReplyText(requestId)));
+            numQueuedEvents++;
+        } });
+
+    int numDispatchedEvents = 0;
+    while (numDispatchedEvents < numEvents)
+    {
+        while (numQueuedEvents == numDispatchedEvents)
+        {
+            std::this_thread::yield();
+        }
+        numDispatchedEvents = numQueuedEvents;
+        eventBus.DispatchQueuedEvents();
+    }
+    producer.join();
+    eventBus.DispatchQueuedEvents();
+    assert(client.numReplies == numEvents);
+}
+
+int main()
+{
+    TestPayloadQueuedFromListener();
+    TestPayloadsFromAnotherThread();
+    std::cout << "EventBusTest passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../src/EventBus/EventQueue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int NUM_PRODUCERS = 8;
+const int NUM_EVENTS_PER_PRODUCER = 250000;
+
+struct SequencedEvent
+{
+    int producer;
+    int sequence;
+    // Not trivially copyable, so a lost move or a double destroy shows up in the sanitizers
+    std::string name;
+
+    SequencedEvent(int producer, int sequence) : producer(producer), sequence(sequence), name("sequenced event") {}
+};
+
+// 8 producer threads push numbered events while the main thread keeps draining the queue.
+// Every drain must hold each producer's events in sequence order, with none lost or duplicated,
+// and the events of one producer are contiguous in a drain. Prints the throughput
+void TestConcurrentPushAndDrain()
+{
+    EventQueue<SequencedEvent> queue;
+    std::atomic<int> numDoneProducers{0};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < NUM_PRODUCERS; producer++)
+    {
+        producers.emplace_back([&queue, &numDoneProducers, producer]()
+                               {
+            for (int sequence = 0; sequence < NUM_EVENTS_PER_PRODUCER; sequence++)
+            {
+                queue.Push(producer, sequence);
+            }
+            numDoneProducers++; });
+    }
+
+    std::vector<int> nextSequences(NUM_PRODUCERS, 0);
+    std::vector<SequencedEvent> events;
+    bool isDone = false;
+    while (!isDone)
+    {
+        // Read the flag before draining, so the last drain sees all the events
+        isDone = numDoneProducers == NUM_PRODUCERS;
+        events.clear();
+        queue.Drain(events);
+
+        std::vector<bool> isProducerDrained(NUM_PRODUCERS, false);
+        for (std::size_t i = 0; i < events.size(); i++)
+        {
+            const auto &event = events[i];
+            assert(event.name == "sequenced event");
+            assert(event.sequence == nextSequences[event.producer]);
+            nextSequences[event.producer]++;
+
+            if (i > 0 && events[i - 1].producer != event.producer)
+            {
+                assert(!isProducerDrained[event.producer]);
+                isProducerDrained[events[i - 1].producer] = true;
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+
+    for (int producer = 0; producer < NUM_PRODUCERS; producer++)
+    {
+        assert(nextSequences[producer] == NUM_EVENTS_PER_PRODUCER);
+    }
+    events.clear();
+    queue.Drain(events);
+    assert(events.empty());
+
+    const int numEvents = NUM_PRODUCERS * NUM_EVENTS_PER_PRODUCER;
+    std::cout << NUM_PRODUCERS << " producers pushed " << numEvents << " events in " << seconds * 1000.0
+              << " ms (" << numEvents / seconds / 1e6 << " M events/s)" << std::endl;
+}
+
+// Every producer thread runs several tasks, each with its own sort key, interleaved with the
+// tasks of the other threads. The drained order only depends on the keys, not on which thread
+// ran a task or when, and a key doesn't outlive its task
+void TestSortKeysOrderInterleavedTasks()
+{
+    const int numTasks = 64;
+    const int numEventsPerTask = 1000;
+    EventQueue<SequencedEvent> queue;
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < NUM_PRODUCERS; producer++)
+    {
+        producers.emplace_back([&queue, producer]()
+                               {
+            // The threads take the tasks in reverse key order, so the push order is far from the sorted one
+            for (int task = numTasks - 1 - producer; task >= 0; task -= NUM_PRODUCERS)
+            {
+                {
+                    EventSortKeyScope sortKeyScope(task);
+                    for (int sequence = 0; sequence < numEventsPerTask; sequence++)
+                    {
+                        queue.Push(task, sequence);
+                        if (sequence % 100 == 0)
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                }
+                assert(CurrentEventSortKey() == 0);
+            } });
+    }
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+
+    std::vector<SequencedEvent> events;
+    queue.Drain(events);
+    assert(events.size() == static_cast<std::size_t>(numTasks * numEventsPerTask));
+    for (std::size_t i = 0; i < events.size(); i++)
+    {
+        assert(events[i].producer == static_cast<int>(i) / numEventsPerTask);
+        assert(events[i].sequence == static_cast<int>(i) % numEventsPerTask);
+    }
+}
+
+int main()
+{
+    TestConcurrentPushAndDrain();
+    TestSortKeysOrderInterleavedTasks();
+    std::cout << "EventQueueTest passed" << std::endl;
+    return 0;
+}